@@ -0,0 +1,394 @@
+/* bench.c: Concurrent HTTP load generation */
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Connection States */
+
+enum {
+    BENCH_CONNECTING,       // Waiting for connect to complete
+    BENCH_SENDING,          // Waiting for batch of requests to be sent
+    BENCH_RECEIVING,        // Waiting for responses
+    BENCH_IDLE,             // No work left, connection closed
+};
+
+/* Structures */
+
+typedef struct {
+    int         fd;                         // Socket file descriptor
+    int         state;                      // BENCH_* state
+    Response    response;                   // Parser for response being read
+    char       *batch;                      // Requests being sent
+    size_t      nbatch;                     // Bytes in batch
+    size_t      sent;                       // Bytes of batch already sent
+    uint64_t    issued[BENCH_PIPELINE_MAX]; // Send times of outstanding requests (FIFO)
+    size_t      first;                      // Index of oldest outstanding request
+    size_t      inflight;                   // Number of outstanding requests
+    char        buffer[BENCH_BUFFER];       // Received bytes
+} BenchConnection;
+
+typedef struct {
+    const Bench        *bench;          // Benchmark parameters
+    int                 nconnections;   // Connections driven by this worker
+    uint64_t            quota;          // Requests this worker may issue
+    uint64_t            started;        // Requests issued so far
+    uint64_t            deadline;       // When to stop (us, 0 for none)
+    BenchConnection    *connections;    // Connections of this worker
+    Ring               *ring;           // Completion ring
+    Histogram           latency;        // Request latency (us)
+    uint64_t            requests;       // Responses completed
+    uint64_t            bytes;          // Body bytes received
+    uint64_t            errors;         // Failed connections and requests
+    pthread_t           thread;         // Worker thread
+} BenchWorker;
+
+/* Connection Functions */
+
+/**
+ * Determine whether worker may issue another request.
+ * @param   w           Worker
+ * @param   now         Current time (us)
+ * @return  true if quota and deadline allow another request
+ **/
+static bool bench_more(BenchWorker *w, uint64_t now) {
+    return w->started < w->quota && (w->deadline == 0 || now < w->deadline);
+}
+
+/**
+ * Open socket and start connecting it.
+ * @param   w           Worker
+ * @param   c           Connection to (re)connect
+ * @return  true if connect was queued, otherwise false
+ **/
+static bool bench_connect(BenchWorker *w, BenchConnection *c) {
+    c->fd       = socket_open(w->bench->address.family, SOCKET_NONBLOCK | SOCKET_CLOEXEC | SOCKET_NODELAY);
+    c->state    = BENCH_CONNECTING;
+    c->inflight = 0;
+    c->first    = 0;
+    http_init(&c->response, false);
+    if (c->fd >= 0 && ring_connect(w->ring, c->fd, &w->bench->address, c)) return true;
+
+    if (c->fd >= 0) close(c->fd);
+    c->fd    = -1;
+    c->state = BENCH_IDLE;
+    return false;
+}
+
+/**
+ * Close connection, counting any outstanding requests as failed.
+ * @param   w           Worker
+ * @param   c           Connection to close
+ **/
+static void bench_close(BenchWorker *w, BenchConnection *c) {
+    w->errors += c->inflight;
+    if (c->fd >= 0) close(c->fd);
+    c->fd       = -1;
+    c->inflight = 0;
+    c->state    = BENCH_IDLE;
+}
+
+/**
+ * Replace connection the server closed (or that failed) with a new one if
+ * there is work left.
+ * @param   w           Worker
+ * @param   c           Connection
+ * @param   now         Current time (us)
+ **/
+static void bench_reconnect(BenchWorker *w, BenchConnection *c, uint64_t now) {
+    bench_close(w, c);
+    if (bench_more(w, now) && !bench_connect(w, c)) w->errors++;
+}
+
+/**
+ * Fill pipeline with new requests and send them, or wait for responses
+ * already outstanding.
+ * @param   w           Worker
+ * @param   c           Connection
+ * @param   now         Current time (us)
+ **/
+static void bench_issue(BenchWorker *w, BenchConnection *c, uint64_t now) {
+    const Bench *b = w->bench;
+
+    size_t count = 0;
+    while (c->inflight + count < (size_t)b->pipeline && bench_more(w, now)) {
+        c->issued[(c->first + c->inflight + count) % BENCH_PIPELINE_MAX] = now;
+        w->started++;
+        count++;
+    }
+
+    if (count > 0) {
+        c->inflight += count;
+        c->nbatch    = count * b->nrequest;
+        c->sent      = 0;
+        c->state     = BENCH_SENDING;
+        if (ring_send(w->ring, c->fd, c->batch, c->nbatch, c)) return;
+    } else if (c->inflight > 0) {
+        c->state = BENCH_RECEIVING;
+        if (ring_recv(w->ring, c->fd, c->buffer, BENCH_BUFFER, c)) return;
+    } else {
+        bench_close(w, c);
+        return;
+    }
+
+    w->errors++;
+    bench_close(w, c);
+}
+
+/**
+ * Record response of oldest outstanding request and reset parser.
+ * @param   w           Worker
+ * @param   c           Connection
+ * @param   now         Current time (us)
+ * @return  true if connection can carry more requests, otherwise false
+ **/
+static bool bench_finish(BenchWorker *w, BenchConnection *c, uint64_t now) {
+    Response *r = &c->response;
+
+    histogram_record(&w->latency, now - c->issued[c->first]);
+    c->first = (c->first + 1) % BENCH_PIPELINE_MAX;
+    c->inflight--;
+    w->requests++;
+    if (r->status / 100 != 2) w->errors++;
+
+    bool keep_alive = r->keep_alive;
+    http_init(r, false);
+    return keep_alive;
+}
+
+/**
+ * Parse received bytes, recording each response that completes.
+ * @param   w           Worker
+ * @param   c           Connection
+ * @param   size        Number of bytes received
+ * @param   now         Current time (us)
+ * @return  true if connection can carry more requests, otherwise false
+ **/
+static bool bench_parse(BenchWorker *w, BenchConnection *c, size_t size, uint64_t now) {
+    Response *r = &c->response;
+
+    for (size_t offset = 0; offset < size; ) {
+        ssize_t n;
+        if (!http_head_done(r)) {
+            n = http_parse_head(r, c->buffer + offset, size - offset);
+        } else {
+            size_t payload, npayload;
+            n = http_parse_body(r, c->buffer + offset, size - offset, &payload, &npayload);
+            w->bytes += npayload;
+        }
+        if (n < 0 || c->inflight == 0) {
+            w->errors++;
+            return false;
+        }
+        offset += n;
+
+        if (http_done(r) && !bench_finish(w, c, now)) return false;
+    }
+    return true;
+}
+
+/* Worker Functions */
+
+/**
+ * Drive worker's connections until quota or deadline is reached.
+ * @param   arg         Pointer to worker
+ * @return  NULL
+ **/
+static void *bench_worker(void *arg) {
+    BenchWorker *w = arg;
+    int active = 0;
+
+    for (int i = 0; i < w->nconnections; i++) {
+        BenchConnection *c = &w->connections[i];
+        if (bench_connect(w, c)) active++;
+        else w->errors++;
+    }
+
+    Completion completions[64];
+    while (active > 0) {
+        uint64_t now     = timing_now();
+        int64_t  timeout = -1;
+        if (w->deadline) {
+            if (now >= w->deadline) break;
+            timeout = w->deadline - now;
+        }
+
+        int n = ring_wait(w->ring, completions, 64, timeout);
+        if (n < 0) {
+            fprintf(stderr, "Unable to wait for completions: %s\n", strerror(errno));
+            break;
+        }
+
+        now = timing_now();
+        for (int i = 0; i < n; i++) {
+            BenchConnection *c      = completions[i].data;
+            int              result = completions[i].result;
+
+            switch (c->state) {
+                case BENCH_CONNECTING:
+                    if (result < 0) {
+                        w->errors++;
+                        bench_close(w, c);
+                        break;
+                    }
+                    bench_issue(w, c, now);
+                    break;
+
+                case BENCH_SENDING:
+                    if (result <= 0) {
+                        bench_reconnect(w, c, now);
+                        break;
+                    }
+                    c->sent += result;
+                    if (c->sent < c->nbatch) {
+                        if (!ring_send(w->ring, c->fd, c->batch + c->sent, c->nbatch - c->sent, c)) bench_close(w, c);
+                        break;
+                    }
+                    c->state = BENCH_RECEIVING;
+                    if (!ring_recv(w->ring, c->fd, c->buffer, BENCH_BUFFER, c)) bench_close(w, c);
+                    break;
+
+                case BENCH_RECEIVING:
+                    // Body delimited by end of stream is complete on close
+                    if (result == 0 && c->inflight > 0 && http_head_done(&c->response) && http_body_eof(&c->response)) {
+                        bench_finish(w, c, now);
+                    }
+                    if (result <= 0 || !bench_parse(w, c, result, now)) {
+                        bench_reconnect(w, c, now);
+                        break;
+                    }
+                    bench_issue(w, c, now);
+                    break;
+            }
+            if (c->state == BENCH_IDLE) active--;
+        }
+    }
+
+    for (int i = 0; i < w->nconnections; i++) {
+        if (w->connections[i].fd >= 0) close(w->connections[i].fd);
+    }
+    return NULL;
+}
+
+/* Functions */
+
+/**
+ * Run load benchmark against URL and print throughput and latency.
+ *
+ * Connections are spread over worker threads, each of which drives its share
+ * through a completion ring.  Every connection keeps up to bench->pipeline
+ * requests outstanding and reconnects when the server closes it.
+ * @param   bench       Benchmark parameters
+ * @param   json        Whether to print results as JSON
+ * @return  true if every request succeeded, otherwise false
+ **/
+bool bench_run(Bench *bench, bool json) {
+    // Resolve target once and prepare pipelined request batch
+    AddressSet *set = socket_resolve(bench->url.host, bench->url.port);
+    if (set == NULL) return false;
+    bench->address = set->data[0];
+    address_set_delete(set);
+
+    char request[2*BUFSIZ + PATH_MAX];
+    int  nrequest = request_format(request, sizeof(request), &bench->url, "GET", "");
+    if (nrequest < 0) return false;
+
+    bench->nrequest = nrequest;
+    char *batch = malloc((size_t)nrequest * bench->pipeline);
+    if (batch == NULL) {
+        fprintf(stderr, "Unable to malloc: %s\n", strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < bench->pipeline; i++) memcpy(batch + (size_t)i * nrequest, request, nrequest);
+
+    // Start workers
+    if (bench->threads > bench->connections) bench->threads = bench->connections;
+
+    BenchWorker     *workers     = calloc(bench->threads, sizeof(BenchWorker));
+    BenchConnection *connections = calloc(bench->connections, sizeof(BenchConnection));
+    if (workers == NULL || connections == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        free(workers);
+        free(connections);
+        free(batch);
+        return false;
+    }
+
+    uint64_t started  = timing_now();
+    uint64_t deadline = bench->duration > 0 ? started + (uint64_t)(bench->duration * 1e6) : 0;
+    int      offset   = 0;
+    for (int i = 0; i < bench->threads; i++) {
+        BenchWorker *w = &workers[i];
+        w->bench        = bench;
+        w->nconnections = bench->connections / bench->threads + (i < bench->connections % bench->threads);
+        w->connections  = connections + offset;
+        w->quota        = bench->count ? bench->count / bench->threads + ((uint64_t)i < bench->count % bench->threads) : UINT64_MAX;
+        w->deadline     = deadline;
+        w->ring         = ring_create(2 * w->nconnections, bench->uring ? RING_URING : RING_EPOLL);
+        histogram_init(&w->latency);
+        offset += w->nconnections;
+
+        for (int j = 0; j < w->nconnections; j++) {
+            w->connections[j].fd    = -1;
+            w->connections[j].batch = batch;
+        }
+
+        if (w->ring == NULL || (errno = pthread_create(&w->thread, NULL, bench_worker, w)) != 0) {
+            if (w->ring) fprintf(stderr, "Unable to pthread_create: %s\n", strerror(errno));
+            w->errors = w->nconnections;
+            w->thread = 0;
+        }
+    }
+
+    // Collect results
+    Histogram latency;
+    uint64_t  requests = 0, bytes = 0, errors = 0;
+    histogram_init(&latency);
+
+    for (int i = 0; i < bench->threads; i++) {
+        BenchWorker *w = &workers[i];
+        if (w->thread) pthread_join(w->thread, NULL);
+        if (w->ring) ring_delete(w->ring);
+        histogram_merge(&latency, &w->latency);
+        requests += w->requests;
+        bytes    += w->bytes;
+        errors   += w->errors;
+    }
+
+    double elapsed = (timing_now() - started) / 1e6;
+    double rate    = requests / elapsed;
+
+    if (json) {
+        fprintf(stderr, "{\"connections\": %d, \"threads\": %d, \"pipeline\": %d, \"requests\": %lu, \"errors\": %lu, "
+            "\"bytes\": %lu, \"elapsed\": %.6f, \"rps\": %.1f, \"latency\": {\"min\": %lu, \"median\": %lu, "
+            "\"p90\": %lu, \"p99\": %lu, \"max\": %lu, \"mean\": %.1f}}\n",
+            bench->connections, bench->threads, bench->pipeline, requests, errors, bytes, elapsed, rate,
+            latency.total ? latency.min : 0,
+            histogram_percentile(&latency, 50),
+            histogram_percentile(&latency, 90),
+            histogram_percentile(&latency, 99),
+            latency.max,
+            histogram_mean(&latency));
+    } else {
+        fprintf(stderr, "Connections:  %d over %d threads (pipeline %d)\n", bench->connections, bench->threads, bench->pipeline);
+        fprintf(stderr, "Requests:     %lu in %.2f s (%lu errors)\n", requests, elapsed, errors);
+        fprintf(stderr, "Throughput:   %.1f requests/s, %.2f MB/s\n", rate, bytes / (MEGABYTES * elapsed));
+        fprintf(stderr, "Latency (ms): min %.3f, median %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+            (latency.total ? latency.min : 0) / 1000.0,
+            histogram_percentile(&latency, 50) / 1000.0,
+            histogram_percentile(&latency, 90) / 1000.0,
+            histogram_percentile(&latency, 99) / 1000.0,
+            latency.max / 1000.0);
+    }
+
+    free(workers);
+    free(connections);
+    free(batch);
+    return errors == 0 && requests > 0;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,264 @@
+/* cache.c: On-disk response cache with conditional revalidation */
+
+#define _GNU_SOURCE
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+/* Structures */
+
+typedef struct {
+    char    body[PATH_MAX];             // Path of cached body
+    char    meta[PATH_MAX];             // Path of URL and validators of body
+    char    temp[PATH_MAX];             // Path new body is downloaded to
+    char    etag[HTTP_VALUE_MAX];       // ETag of cached body ("" if unset)
+    char    modified[HTTP_VALUE_MAX];   // Last-Modified of cached body ("" if unset)
+} CacheEntry;
+
+/* Validator Functions */
+
+/**
+ * Load validators recorded for URL.
+ *
+ * A validator file holds the URL itself (so a file left by another URL is
+ * never trusted) followed by the ETag and Last-Modified values the server
+ * sent with the body.
+ * @param   path        Path of validator file
+ * @param   url         URL being fetched
+ * @param   etag        Buffer of HTTP_VALUE_MAX bytes for ETag ("" if unset)
+ * @param   modified    Buffer of HTTP_VALUE_MAX bytes for Last-Modified ("" if unset)
+ * @return  true if the file describes URL and holds a validator, otherwise false
+ **/
+bool validators_load(const char *path, const URL *url, char *etag, char *modified) {
+    etag[0]     = '\0';
+    modified[0] = '\0';
+
+    FILE *fs = fopen(path, "re");
+    if (fs == NULL) return false;
+
+    char buffer[BUFSIZ + PATH_MAX];
+    char key[BUFSIZ + PATH_MAX];
+    bool match = false;
+    snprintf(key, sizeof(key), "url %s:%s/%s\n", url->host, url->port, url->path);
+
+    while (fgets(buffer, sizeof(buffer), fs)) {
+        if (streq(buffer, key)) {
+            match = true;
+            continue;
+        }
+        buffer[strcspn(buffer, "\n")] = '\0';
+        if (strncmp(buffer, "etag ", 5) == 0) {
+            snprintf(etag, HTTP_VALUE_MAX, "%s", buffer + 5);
+        } else if (strncmp(buffer, "modified ", 9) == 0) {
+            snprintf(modified, HTTP_VALUE_MAX, "%s", buffer + 9);
+        }
+    }
+    fclose(fs);
+
+    return match && (*etag || *modified);
+}
+
+/**
+ * Record validators of response for URL, replacing the file atomically.
+ * @param   path        Path of validator file
+ * @param   url         URL body was fetched from
+ * @param   r           Response carrying the validators
+ * @return  true on success, otherwise false
+ **/
+bool validators_store(const char *path, const URL *url, const Response *r) {
+    char temp[PATH_MAX + 8];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE *fs = fopen(temp, "we");
+    if (fs == NULL) {
+        fprintf(stderr, "Unable to fopen %s: %s\n", temp, strerror(errno));
+        return false;
+    }
+    fprintf(fs, "url %s:%s/%s\n", url->host, url->port, url->path);
+    if (*r->etag)     fprintf(fs, "etag %s\n", r->etag);
+    if (*r->modified) fprintf(fs, "modified %s\n", r->modified);
+    if (fclose(fs) != 0 || rename(temp, path) < 0) {
+        fprintf(stderr, "Unable to write %s: %s\n", path, strerror(errno));
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+/* Cache Functions */
+
+/**
+ * Compute 64-bit FNV-1a hash of host, port, and path of URL.
+ * @param   url         URL to hash
+ * @return  Hash of URL
+ **/
+static uint64_t cache_hash(const URL *url) {
+    const char *parts[] = {url->host, ":", url->port, "/", url->path};
+    uint64_t    hash    = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        for (const char *s = parts[i]; *s; s++) {
+            hash ^= (unsigned char)*s;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+/**
+ * Load cache entry of URL.
+ *
+ * Every URL maps to a body file named after the hash of the URL and a meta
+ * file holding its validators.
+ * @param   dir         Cache directory
+ * @param   url         URL being fetched
+ * @param   e           Cache entry to fill in
+ * @return  true if a usable body is cached for URL, otherwise false
+ **/
+static bool cache_load(const char *dir, const URL *url, CacheEntry *e) {
+    uint64_t hash = cache_hash(url);
+    snprintf(e->body, sizeof(e->body), "%s/%016lx", dir, hash);
+    snprintf(e->meta, sizeof(e->meta), "%s/%016lx.meta", dir, hash);
+    snprintf(e->temp, sizeof(e->temp), "%s/%016lx.%d.tmp", dir, hash, getpid());
+
+    return validators_load(e->meta, url, e->etag, e->modified) && access(e->body, R_OK) == 0;
+}
+
+/**
+ * Move downloaded body into place and record its validators.
+ * @param   e           Cache entry
+ * @param   url         URL body was fetched from
+ * @param   r           Response body was read from
+ * @return  true on success, otherwise false
+ **/
+static bool cache_store(CacheEntry *e, const URL *url, const Response *r) {
+    // Drop old validators first so they never describe the new body
+    unlink(e->meta);
+    if (rename(e->temp, e->body) < 0) {
+        fprintf(stderr, "Unable to rename %s: %s\n", e->body, strerror(errno));
+        return false;
+    }
+    return validators_store(e->meta, url, r);
+}
+
+/**
+ * Copy whole file to sink, with sendfile when the sink allows it.
+ * @param   fd          File descriptor of file to copy
+ * @param   sink        Sink to write to
+ * @return  true if every byte was written, otherwise false
+ **/
+static bool cache_send(int fd, Sink *sink) {
+    if (sink->fd < 0) return true;
+
+    struct stat s;
+    if (fstat(fd, &s) < 0) {
+        fprintf(stderr, "Unable to fstat: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Sequential sinks take the file in kernel space
+    off_t offset = 0;
+    while (sink->offset < 0 && !sink->copy && offset < s.st_size) {
+        ssize_t n = sendfile(sink->fd, fd, &offset, s.st_size - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            sink->copy = true;
+            break;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "Unable to sendfile: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    char buffer[BUFSIZ];
+    while (offset < s.st_size) {
+        ssize_t n = pread(fd, buffer, sizeof(buffer), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Unable to read: %s\n", n < 0 ? strerror(errno) : "file truncated");
+            return false;
+        }
+        if (!sink_output(sink, buffer, n)) return false;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * Fetch URL through cache directory and write body to sink.
+ *
+ * A cached body is revalidated with If-None-Match and If-Modified-Since; on
+ * 304 it is served from disk without transferring it again.  Cacheable 200
+ * responses (those with an ETag or Last-Modified) are downloaded into the
+ * cache first and then copied to the sink.  Transfer statistics only count
+ * bytes received from the network.
+ * @param   pool        Connection pool
+ * @param   url         URL to fetch
+ * @param   dir         Cache directory
+ * @param   sink        Sink to write body to
+ * @param   stats       Transfer statistics to update
+ * @return  true if the whole body was written to sink, otherwise false
+ **/
+bool fetch_cached(Pool *pool, URL *url, const char *dir, Sink *sink, Stats *stats) {
+    CacheEntry e;
+    bool       cached = cache_load(dir, url, &e);
+
+    char headers[2*HTTP_VALUE_MAX + 128] = ACCEPT_ENCODING;
+    if (cached && *e.etag) {
+        size_t n = strlen(headers);
+        snprintf(headers + n, sizeof(headers) - n, "If-None-Match: %s\r\n", e.etag);
+    }
+    if (cached && *e.modified) {
+        size_t n = strlen(headers);
+        snprintf(headers + n, sizeof(headers) - n, "If-Modified-Since: %s\r\n", e.modified);
+    }
+
+    Response    r;
+    Connection *c = request_open(pool, url, "GET", headers, &r);
+    if (c == NULL) return false;
+
+    // Cached body is still current
+    if (cached && r.status == 304) {
+        request_body(pool, c, &r, NULL, stats);
+
+        int fd = open(e.body, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "Unable to open %s: %s\n", e.body, strerror(errno));
+            return false;
+        }
+        bool success = cache_send(fd, sink);
+        close(fd);
+        return success;
+    }
+
+    if (r.status / 100 != 2) {
+        fprintf(stderr, "Unable to fetch %s:%s/%s: status %d\n", url->host, url->port, url->path, r.status);
+        request_body(pool, c, &r, NULL, stats);
+        return false;
+    }
+
+    // Responses without validators cannot be revalidated, so are not kept
+    int fd = -1;
+    if (r.status == 200 && (*r.etag || *r.modified)) {
+        fd = open(e.temp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) fprintf(stderr, "Unable to open %s: %s\n", e.temp, strerror(errno));
+    }
+    if (fd < 0) return request_body(pool, c, &r, sink, stats);
+
+    Sink file    = {fd, -1};
+    bool success = request_body(pool, c, &r, &file, stats);
+    if (!success || !cache_store(&e, url, &r)) unlink(e.temp);
+    if (success) success = cache_send(fd, sink);
+    close(fd);
+    return success;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
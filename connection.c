@@ -0,0 +1,200 @@
+/* connection.c: Buffered HTTP connections and per-host connection pool */
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Connection Functions */
+
+/**
+ * Dial new connection to host and port of URL.
+ * @param   url         URL to connect to
+ * @return  Newly allocated connection, or NULL on failure
+ **/
+Connection *connection_dial(const URL *url) {
+    // Resolve and connect separately so each phase can be timed
+    uint64_t    started = timing_now();
+    AddressSet *set     = socket_resolve(url->host, url->port);
+    if (set == NULL) return NULL;
+
+    uint64_t resolved = timing_now();
+    int      fd       = -1;
+    for (size_t i = 0; i < set->size && fd < 0; i++) {
+        fd = socket_connect(&set->data[i], SOCKET_CLOEXEC | SOCKET_NODELAY);
+    }
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to connect to %s:%s: %s\n", url->host, url->port, strerror(errno));
+        address_set_delete(set);
+        return NULL;
+    }
+    address_set_delete(set);
+
+    uint64_t connected = timing_now();
+
+    Connection *c = malloc(sizeof(Connection));
+    if (c == NULL) {
+        fprintf(stderr, "Unable to malloc: %s\n", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    c->fd        = fd;
+    c->requests  = 0;
+    c->resolved  = resolved - started;
+    c->connected = connected - resolved;
+    c->pipe[0]   = -1;
+    c->pipe[1]   = -1;
+    c->transfer  = NULL;
+    c->start     = 0;
+    c->end       = 0;
+    snprintf(c->host, sizeof(c->host), "%s", url->host);
+    snprintf(c->port, sizeof(c->port), "%s", url->port);
+    return c;
+}
+
+/**
+ * Close connection and release its memory.
+ * @param   c           Connection to close
+ **/
+void connection_close(Connection *c) {
+    if (c == NULL) return;
+    if (c->pipe[0] >= 0) close(c->pipe[0]);
+    if (c->pipe[1] >= 0) close(c->pipe[1]);
+    close(c->fd);
+    free(c->transfer);
+    free(c);
+}
+
+/**
+ * Receive more bytes into connection buffer.
+ * @param   c           Connection to read from
+ * @return  Number of bytes received, 0 on end of stream (or full buffer), -1
+ * on error
+ **/
+ssize_t connection_fill(Connection *c) {
+    // Move unread bytes to front of buffer to make room
+    if (c->start == c->end) {
+        c->start = c->end = 0;
+    } else if (c->start > 0 && c->end == CONNECTION_BUFFER) {
+        memmove(c->buffer, c->buffer + c->start, c->end - c->start);
+        c->end  -= c->start;
+        c->start = 0;
+    }
+
+    if (c->end == CONNECTION_BUFFER) return 0;
+
+    ssize_t n;
+    do {
+        n = recv(c->fd, c->buffer + c->end, CONNECTION_BUFFER - c->end, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) c->end += n;
+    return n;
+}
+
+/**
+ * Send all bytes on connection.
+ * @param   c           Connection to write to
+ * @param   data        Bytes to send
+ * @param   size        Number of bytes to send
+ * @return  true if every byte was sent, otherwise false
+ **/
+bool connection_send(Connection *c, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(c->fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* Pool Functions */
+
+/**
+ * Initialize empty connection pool.
+ * @param   pool        Pointer to pool
+ **/
+void pool_init(Pool *pool) {
+    pool->idle     = NULL;
+    pool->size     = 0;
+    pool->capacity = 0;
+    pool->opened   = 0;
+}
+
+/**
+ * Close every idle connection in pool.
+ * @param   pool        Pointer to pool
+ **/
+void pool_delete(Pool *pool) {
+    for (size_t i = 0; i < pool->size; i++) connection_close(pool->idle[i]);
+    free(pool->idle);
+    pool_init(pool);
+}
+
+/**
+ * Take idle connection to host of URL from pool or dial a new one.
+ * @param   pool        Pointer to pool
+ * @param   url         URL to be requested
+ * @return  Connection to host of URL, or NULL on failure
+ **/
+Connection *pool_acquire(Pool *pool, const URL *url) {
+    // Most recently released connections are least likely to have timed out
+    for (size_t i = pool->size; i > 0; i--) {
+        Connection *c = pool->idle[i - 1];
+        if (streq(c->host, url->host) && streq(c->port, url->port)) {
+            memmove(&pool->idle[i - 1], &pool->idle[i], (pool->size - i) * sizeof(Connection *));
+            pool->size--;
+            return c;
+        }
+    }
+
+    Connection *c = connection_dial(url);
+    if (c) pool->opened++;
+    return c;
+}
+
+/**
+ * Return connection to pool after a request.
+ * @param   pool        Pointer to pool
+ * @param   c           Connection to return
+ * @param   reuse       Whether connection can carry another request
+ **/
+void pool_release(Pool *pool, Connection *c, bool reuse) {
+    if (!reuse) {
+        connection_close(c);
+        return;
+    }
+
+    // Evict oldest idle connection to same host when over the limit
+    size_t same = 0, oldest = pool->size;
+    for (size_t i = 0; i < pool->size; i++) {
+        if (streq(pool->idle[i]->host, c->host) && streq(pool->idle[i]->port, c->port)) {
+            if (same++ == 0) oldest = i;
+        }
+    }
+    if (same >= POOL_IDLE_MAX) {
+        connection_close(pool->idle[oldest]);
+        memmove(&pool->idle[oldest], &pool->idle[oldest + 1], (pool->size - oldest - 1) * sizeof(Connection *));
+        pool->size--;
+    }
+
+    if (pool->size == pool->capacity) {
+        size_t       capacity = pool->capacity ? 2 * pool->capacity : POOL_IDLE_MAX;
+        Connection **idle     = realloc(pool->idle, capacity * sizeof(Connection *));
+        if (idle == NULL) {
+            connection_close(c);
+            return;
+        }
+        pool->idle     = idle;
+        pool->capacity = capacity;
+    }
+    pool->idle[pool->size++] = c;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
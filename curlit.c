@@ -1,35 +1,15 @@
 /* curlit.c: Simple HTTP client*/
 
-#include "socket.h"
+#include "curlit.h"
 
-#include <limits.h>
-#include <stdbool.h>
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-#include <netdb.h>
-
-/* Constants */
-
-#define HOST_DELIMITER  "://"
-#define PATH_DELIMITER  '/'
-#define PORT_DELIMITER  ':'
-#define BILLION         (1000000000.0)
-#define MEGABYTES       (1<<20)
-
-/* Macros */
-
-#define streq(a, b) (strcmp(a, b) == 0)
-
-/* Structures */
-
-typedef struct {
-    char host[NI_MAXHOST];
-    char port[NI_MAXSERV];
-    char path[PATH_MAX];
-} URL;
+#include <sys/stat.h>
 
 /* Functions */
 
@@ -38,103 +18,193 @@ typedef struct {
  * @param   status      Exit status.
  **/
 void    usage(int status) {
-    fprintf(stderr, "Usage: curlit [-h] URL\n");
+    fprintf(stderr, "Usage: curlit [-h] [-o FILE [--resume]] [-c N] [-n N] [-j] [-C DIR] [URL...]\n");
+    fprintf(stderr, "       curlit --bench [-k N] [-t N] [-d SECONDS] [-n N] [-P N] [-u] [-j] URL\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -o FILE     Write body to FILE instead of standard output\n");
+    fprintf(stderr, "    --resume    Continue interrupted download of single URL to FILE\n");
+    fprintf(stderr, "    -c N        Download single URL to FILE over N parallel connections\n");
+    fprintf(stderr, "    -n N        Fetch each URL N times from scratch and report phase latencies\n");
+    fprintf(stderr, "    -j          Report phase latencies as JSON\n");
+    fprintf(stderr, "    -C DIR      Cache bodies in DIR and revalidate them on later fetches\n");
+    fprintf(stderr, "Load generation (--bench):\n");
+    fprintf(stderr, "    -k N        Keep N connections open (default: 10)\n");
+    fprintf(stderr, "    -t N        Drive connections from N threads (default: 1)\n");
+    fprintf(stderr, "    -d SECONDS  Run for SECONDS (default: 10, unless -n is given)\n");
+    fprintf(stderr, "    -n N        Stop after N requests\n");
+    fprintf(stderr, "    -P N        Pipeline N requests per connection (default: 1)\n");
+    fprintf(stderr, "    -u          Use io_uring instead of epoll\n");
+    fprintf(stderr, "URLs are read from standard input, one per line, if none are given (or -)\n");
     exit(status);
 }
 
 /**
- * Parse URL string into URL structure.
- * @param   s       URL string
- * @param   url     Pointer to URL structure
+ * Fetch URL string one or more times.
+ *
+ * When repeating, every fetch starts from scratch with no pooled connection
+ * and no cached resolution, so each one goes through every phase.
+ * @param   pool        Connection pool
+ * @param   s           URL string
+ * @param   sink        Sink to write body to
+ * @param   stats       Transfer statistics to update
+ * @param   repeats     Number of times to fetch URL
+ * @param   cache       Cache directory (NULL to fetch directly)
+ * @return  true if every fetch was successful, otherwise false
  **/
-void    parse_url(const char *s, URL *url) {
-    // Copy data to local buffer
-    char buffer[BUFSIZ];
-    strncpy(buffer, s, BUFSIZ);
-
-    // Skip scheme to host
-    char *scheme = strstr(buffer, "://");
-    if (scheme == NULL) {
-       scheme = buffer;
-    } else {
-        scheme += 3;
+bool    fetch_string(Pool *pool, const char *s, Sink *sink, Stats *stats, int repeats, const char *cache) {
+    URL  url;
+    bool success = true;
+    parse_url(s, &url);
+
+    for (int i = 0; i < repeats; i++) {
+        if (repeats > 1) {
+            size_t opened = pool->opened;
+            pool_delete(pool);
+            pool->opened = opened;
+            socket_cache_flush();
+        }
+        success &= cache ? fetch_cached(pool, &url, cache, sink, stats) : fetch_url(pool, &url, sink, stats);
     }
+    return success;
+}
 
-    // Split host:port from path
-    char *urlpath;
-    urlpath = strstr(scheme, "/");
+/* Main Execution */
 
-    if (urlpath == NULL) urlpath = "";
-    else {
-        *urlpath = '\0';
-        urlpath++;
-    }
+int     main(int argc, char *argv[]) {
+    char  **urls       = calloc(argc, sizeof(char *));
+    size_t  nurls      = 0;
+    bool    from_stdin = false;
+    char   *output     = NULL;
+    int     nsegments  = 1;
+    int     repeats    = 1;
+    bool    json       = false;
+    bool    bench      = false;
+    char   *cache      = NULL;
+    bool    resume     = false;
+    double  duration   = 0;
+    Bench   load       = {.connections = 10, .threads = 1, .pipeline = 1};
 
-    // Split host and port
-    char *urlport;
-    urlport = strstr(scheme, ":");
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        if (streq(argv[i], "-h")) usage(0);
+        else if (streq(argv[i], "-o")) {
+            if (i+1 >= argc) usage(1);
+            output = argv[++i];
+        } else if (streq(argv[i], "-c")) {
+            if (i+1 >= argc) usage(1);
+            nsegments = atoi(argv[++i]);
+            if (nsegments <= 0) usage(1);
+        } else if (streq(argv[i], "-n")) {
+            if (i+1 >= argc) usage(1);
+            repeats = atoi(argv[++i]);
+            if (repeats <= 0) usage(1);
+            load.count = repeats;
+        } else if (streq(argv[i], "-j")) {
+            json = true;
+        } else if (streq(argv[i], "-C")) {
+            if (i+1 >= argc) usage(1);
+            cache = argv[++i];
+        } else if (streq(argv[i], "--resume")) {
+            resume = true;
+        } else if (streq(argv[i], "--bench")) {
+            bench = true;
+        } else if (streq(argv[i], "-k")) {
+            if (i+1 >= argc) usage(1);
+            load.connections = atoi(argv[++i]);
+            if (load.connections <= 0) usage(1);
+        } else if (streq(argv[i], "-t")) {
+            if (i+1 >= argc) usage(1);
+            load.threads = atoi(argv[++i]);
+            if (load.threads <= 0) usage(1);
+        } else if (streq(argv[i], "-d")) {
+            if (i+1 >= argc) usage(1);
+            duration = strtod(argv[++i], NULL);
+            if (duration <= 0) usage(1);
+        } else if (streq(argv[i], "-P")) {
+            if (i+1 >= argc) usage(1);
+            load.pipeline = atoi(argv[++i]);
+            if (load.pipeline <= 0 || load.pipeline > BENCH_PIPELINE_MAX) usage(1);
+        } else if (streq(argv[i], "-u")) {
+            load.uring = true;
+        } else if (streq(argv[i], "-")) {
+            from_stdin = true;
+        } else if (argv[i][0] == '-') {
+            usage(1);
+        } else {
+            urls[nurls++] = argv[i];
+        }
+    }
 
-    if (urlport == NULL) urlport = "80";
-    else {
-        *urlport = '\0';
-        urlport++;
+    // Generate load against single URL
+    if (bench) {
+        if (nurls != 1 || from_stdin || output || nsegments > 1 || cache || resume) usage(1);
+        parse_url(urls[0], &load.url);
+        load.duration = duration > 0 ? duration : (load.count ? 0 : 10);
+        free(urls);
+        return bench_run(&load, json) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    // Copy components to URL
-    strcpy(url->host, scheme);
-    strcpy(url->port, urlport);
-    strcpy(url->path, urlpath);
+    if (nurls == 0) from_stdin = true;
+    if (nsegments > 1 && (output == NULL || nurls != 1 || from_stdin || repeats > 1 || cache)) usage(1);
+    if (resume && (output == NULL || nurls != 1 || from_stdin || repeats > 1 || cache || nsegments > 1)) usage(1);
 
-}
+    // Create cache directory
+    if (cache && mkdir(cache, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Unable to mkdir %s: %s\n", cache, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // Open output file
+    Sink sink = {STDOUT_FILENO, -1};
+    if (repeats > 1 && output == NULL) {
+        sink.fd = -1;       // Repeated bodies are only measured
+    } else if (output) {
+        sink.fd = open(output, O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC) | O_CLOEXEC, 0644);
+        if (sink.fd < 0) {
+            fprintf(stderr, "Unable to open %s: %s\n", output, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
 
-/**
- * Fetch contents of URL and print to standard out.
- *
- * Print elapsed time and bandwidth to standard error.
- * @param   s       URL string
- * @param   url     Pointer to URL structure
- * @return  true if client is able to read all of the content (or if the
- * content length is unset), otherwise false
- **/
-bool    fetch_url(URL *url) {
     // Grab start time
     struct timespec start_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-    // Connect to remote host and port
-    FILE *client_file = socket_dial(url->host, url->port);
-    if (!client_file) {
-        return false;
-    }
-
-    // Send request to server
-    fprintf(client_file, "GET /%s HTTP/1.0\r\n", url->path);
-    fprintf(client_file, "Host: %s\r\n", url->host);
-    fprintf(client_file, "\r\n");
+    // Fetch each URL over pooled connections
+    Histogram phases[NPHASES];
+    for (int p = 0; p < NPHASES; p++) histogram_init(&phases[p]);
 
-    // Read status response from server
-    char buffer[BUFSIZ];
+    Pool  pool;
+    Stats stats   = {0, 0, phases};
+    bool  success = true;
+    pool_init(&pool);
 
-    bool con = true;
-    fgets(buffer, BUFSIZ, client_file);
-    if (strstr(buffer, "200 OK") == NULL) {
-        con = false;
+    if (nsegments > 1 || resume) {
+        URL url;
+        parse_url(urls[0], &url);
+        if (resume) success = fetch_resume(&pool, &url, output, sink.fd, &stats);
+        else        success = fetch_segments(&pool, &url, sink.fd, nsegments, &stats);
+    } else {
+        for (size_t i = 0; i < nurls; i++) {
+            success &= fetch_string(&pool, urls[i], &sink, &stats, repeats, cache);
+        }
     }
 
-    // Read response headers from server
-    int content_length = 0;
-    while ((fgets(buffer, BUFSIZ, client_file)) && strlen(buffer) > 2) {
-        if (strstr(buffer, "Content-Length:")) {
-            sscanf(buffer, "Content-Length: %d", &content_length);
+    if (from_stdin) {
+        char buffer[BUFSIZ];
+        while (fgets(buffer, BUFSIZ, stdin)) {
+            buffer[strcspn(buffer, "\r\n")] = '\0';
+            if (*buffer) success &= fetch_string(&pool, buffer, &sink, &stats, repeats, cache);
         }
     }
 
-    // Read response body from server
-    size_t nread            = 0;
-    size_t total_bytes_read = 0;
-    while ((nread = fread(buffer, 1, BUFSIZ, client_file)) > 0) {
-        fwrite(buffer, 1, nread, stdout);
-        total_bytes_read += nread;
+    size_t opened = pool.opened;
+    pool_delete(&pool);
+    free(urls);
+
+    if (output && close(sink.fd) < 0) {
+        fprintf(stderr, "Unable to close %s: %s\n", output, strerror(errno));
+        success = false;
     }
 
     // Grab end time
@@ -144,39 +214,19 @@ bool    fetch_url(URL *url) {
     double elapsed_time = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / BILLION;
 
     // Output metrics
-    fprintf(stderr, "Elapsed Time: %.2f s\n", elapsed_time);
-    fprintf(stderr, "Bandwidth:    %.2f MB/s\n", total_bytes_read / (MEGABYTES*elapsed_time));
-
-    fclose(client_file);
-    
-    if ((con == false) || ((content_length != 0) && (content_length != total_bytes_read)))  return false;
-    else if ((con == true) && ((content_length == 0) || (content_length == total_bytes_read))) return true;
-
-    return true;
-}
-
-/* Main Execution */
-
-int     main(int argc, char *argv[]) {
-    if (argc != 2) usage(1);
-
-    URL url;
-    char *s;
-    
-    // Parse command line options
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-h") == 0) usage(0);
-        else if (argv[i][0] == '-') usage(1);
-        else {
-            s = argv[i];
-        }
+    if (json) {
+        timing_report(stderr, phases, &stats, elapsed_time, true);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
     }
- 
-    parse_url(s, &url);
 
-    if (!fetch_url(&url)) return EXIT_FAILURE;
+    fprintf(stderr, "Elapsed Time: %.2f s\n", elapsed_time);
+    fprintf(stderr, "Bandwidth:    %.2f MB/s\n", stats.bytes / (MEGABYTES*elapsed_time));
+    if (stats.requests > 1) {
+        fprintf(stderr, "Requests:     %zu over %zu connections\n", stats.requests, opened);
+    }
+    if (repeats > 1) timing_report(stderr, phases, &stats, elapsed_time, false);
 
-    return EXIT_SUCCESS;
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
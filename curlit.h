@@ -0,0 +1,214 @@
+/* curlit.h: Simple HTTP client */
+
+#pragma once
+
+#include "histogram.h"
+#include "socket.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <netdb.h>
+#include <sys/types.h>
+
+/* Constants */
+
+#define HOST_DELIMITER      "://"
+#define PATH_DELIMITER      '/'
+#define PORT_DELIMITER      ':'
+#define BILLION             (1000000000.0)
+#define MEGABYTES           (1<<20)
+#define CONNECTION_BUFFER   (1<<16)     /* Bytes buffered per connection */
+#define POOL_IDLE_MAX       8           /* Idle connections kept per host */
+#define SEGMENT_MINIMUM     (1<<16)     /* Smallest byte range fetched in parallel */
+#define SPLICE_MINIMUM      (1<<14)     /* Smallest body remainder moved with splice */
+#define PIPE_SIZE           (1<<20)     /* Requested capacity of splice pipe */
+#define TRANSFER_BUFFER     (1<<18)     /* Bytes per recv when splice is unavailable */
+#define HTTP_NAME_MAX       64          /* Longest header name recognized */
+#define HTTP_VALUE_MAX      256         /* Longest header value kept */
+#define DECODE_BUFFER       (1<<16)     /* Bytes inflated per call */
+#define ACCEPT_ENCODING     "Accept-Encoding: gzip, deflate\r\n"
+#define RESUME_SUFFIX       ".curlit"   /* Sidecar holding validators of partial download */
+#define BENCH_BUFFER        (1<<16)     /* Bytes received per benchmark recv */
+#define BENCH_PIPELINE_MAX  64          /* Deepest benchmark request pipeline */
+
+/* Request Phases */
+
+enum {
+    PHASE_RESOLVE,      // Resolving host name
+    PHASE_CONNECT,      // Establishing TCP connection
+    PHASE_WRITE,        // Sending request
+    PHASE_FIRST_BYTE,   // Waiting for first byte of response
+    PHASE_TRANSFER,     // Receiving rest of response
+    PHASE_TOTAL,        // Whole request
+    NPHASES,
+};
+
+/* Content Encodings */
+
+enum {
+    ENCODING_IDENTITY,  // Body is sent as is
+    ENCODING_GZIP,      // Body is gzip compressed
+    ENCODING_DEFLATE,   // Body is zlib (or raw deflate) compressed
+    ENCODING_UNKNOWN,   // Body uses an encoding curlit cannot decode
+};
+
+/* Macros */
+
+#define streq(a, b) (strcmp(a, b) == 0)
+
+/* Structures */
+
+typedef struct {
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    char path[PATH_MAX];
+} URL;
+
+typedef struct {
+    int         fd;                         // Socket file descriptor
+    char        host[NI_MAXHOST];           // Host connected to
+    char        port[NI_MAXSERV];           // Port connected to
+    size_t      requests;                   // Requests sent on connection
+    uint64_t    resolved;                   // Time spent resolving host (us)
+    uint64_t    connected;                  // Time spent connecting (us)
+    int         pipe[2];                    // Pipe for splicing body (-1 until needed)
+    char       *transfer;                   // Page-aligned recv buffer (NULL until needed)
+    size_t      start;                      // Offset of first unread byte
+    size_t      end;                        // Offset past last buffered byte
+    char        buffer[CONNECTION_BUFFER];  // Bytes received but not consumed
+} Connection;
+
+typedef struct {
+    Connection **idle;      // Connections waiting for another request
+    size_t       size;      // Number of idle connections
+    size_t       capacity;  // Capacity of idle array
+    size_t       opened;    // Number of connections dialed
+} Pool;
+
+typedef struct {
+    int         status;                 // Status code
+    int         minor;                  // HTTP minor version (ie. 1 for HTTP/1.1)
+    int64_t     length;                 // Content-Length (-1 if unset)
+    bool        chunked;                // Whether body uses chunked transfer-encoding
+    bool        keep_alive;             // Whether connection may be reused afterwards
+    bool        ranges;                 // Whether server accepts byte ranges
+    int64_t     offset;                 // First byte of Content-Range (-1 if unset)
+    int64_t     total;                  // Complete length from Content-Range (-1 if unset)
+    bool        body;                   // Whether a body follows the headers
+    int         encoding;               // Content-Encoding of body
+    char        etag[HTTP_VALUE_MAX];   // ETag validator ("" if unset)
+    char        modified[HTTP_VALUE_MAX]; // Last-Modified validator ("" if unset)
+    uint64_t    timing[NPHASES];        // Duration of each request phase (us)
+    uint64_t    started;                // When request began (us)
+    uint64_t    received;               // When first byte of response arrived (us)
+
+    int         state;                  // Parser state
+    bool        head;                   // Whether request was HEAD
+    int         header;                 // Header whose value is being parsed
+    char        name[HTTP_NAME_MAX];    // Header name (or version) being parsed
+    size_t      nname;                  // Length of name (or digits parsed)
+    char        value[HTTP_VALUE_MAX];  // Value of header of interest
+    size_t      nvalue;                 // Length of value
+    bool        truncated;              // Whether value exceeded HTTP_VALUE_MAX
+    uint64_t    chunk;                  // Payload bytes left in body or chunk
+} Response;
+
+typedef struct Decoder Decoder;
+
+typedef struct {
+    int         fd;         // File descriptor to write to (-1 to discard)
+    off_t       offset;     // Position of next write (-1 for current position)
+    bool        copy;       // Whether fd refused splice and bytes are copied
+    Decoder    *decoder;    // Decoder for encoded body (NULL for identity)
+} Sink;
+
+typedef struct {
+    size_t      requests;   // Number of responses read
+    uint64_t    bytes;      // Number of body bytes written
+    Histogram  *phases;     // Latency of each phase (NULL if not collected)
+} Stats;
+
+typedef struct {
+    URL         url;            // URL requested
+    Address     address;        // Resolved address of host
+    int         connections;    // Number of concurrent connections
+    int         threads;        // Number of worker threads
+    int         pipeline;       // Requests outstanding per connection
+    double      duration;       // How long to run (s, 0 for no limit)
+    uint64_t    count;          // How many requests to issue (0 for no limit)
+    bool        uring;          // Whether to use io_uring instead of epoll
+    size_t      nrequest;       // Length of formatted request
+} Bench;
+
+/* URL Functions */
+
+void    parse_url(const char *s, URL *url);
+
+/* Connection Functions */
+
+Connection *connection_dial(const URL *url);
+void        connection_close(Connection *c);
+ssize_t     connection_fill(Connection *c);
+bool        connection_send(Connection *c, const char *data, size_t size);
+
+/* Pool Functions */
+
+void        pool_init(Pool *pool);
+void        pool_delete(Pool *pool);
+Connection *pool_acquire(Pool *pool, const URL *url);
+void        pool_release(Pool *pool, Connection *c, bool reuse);
+
+/* HTTP Parser Functions */
+
+void        http_init(Response *r, bool head);
+ssize_t     http_parse_head(Response *r, const char *data, size_t size);
+ssize_t     http_parse_body(Response *r, const char *data, size_t size, size_t *payload, size_t *npayload);
+uint64_t    http_body_remaining(const Response *r);
+void        http_body_consumed(Response *r, uint64_t n);
+bool        http_body_eof(Response *r);
+bool        http_head_done(const Response *r);
+bool        http_done(const Response *r);
+
+/* Fetch Functions */
+
+bool        sink_output(Sink *sink, const char *data, size_t size);
+bool        sink_write(Sink *sink, const char *data, size_t size);
+int         request_format(char *buffer, size_t size, const URL *url, const char *method, const char *headers);
+Connection *request_open(Pool *pool, const URL *url, const char *method, const char *headers, Response *r);
+bool        request_body(Pool *pool, Connection *c, Response *r, Sink *sink, Stats *stats);
+bool        fetch_url(Pool *pool, URL *url, Sink *sink, Stats *stats);
+
+/* Decode Functions */
+
+bool    decode_init(Sink *sink, int encoding);
+bool    decode_write(Sink *sink, const char *data, size_t size);
+bool    decode_end(Sink *sink);
+
+/* Cache Functions */
+
+bool    validators_load(const char *path, const URL *url, char *etag, char *modified);
+bool    validators_store(const char *path, const URL *url, const Response *r);
+bool    fetch_cached(Pool *pool, URL *url, const char *dir, Sink *sink, Stats *stats);
+
+/* Resume Functions */
+
+bool    fetch_resume(Pool *pool, URL *url, const char *path, int fd, Stats *stats);
+
+/* Segment Functions */
+
+bool    fetch_segments(Pool *pool, URL *url, int fd, int nsegments, Stats *stats);
+
+/* Bench Functions */
+
+bool    bench_run(Bench *bench, bool json);
+
+/* Timing Functions */
+
+uint64_t    timing_now();
+void        timing_record(Histogram *phases, const Response *r);
+void        timing_report(FILE *stream, const Histogram *phases, const Stats *stats, double elapsed, bool json);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,117 @@
+/* decode.c: Streaming Content-Encoding decoder */
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+/* Structures */
+
+struct Decoder {
+    z_stream    stream;                 // Inflate state
+    int         encoding;               // ENCODING_GZIP or ENCODING_DEFLATE
+    bool        started;                // Whether any input was decoded
+    bool        ended;                  // Whether end of stream was reached
+    char        output[DECODE_BUFFER];  // Decoded bytes awaiting the sink
+};
+
+/* Functions */
+
+/**
+ * Attach decoder for content encoding to sink.
+ *
+ * Bytes written to the sink afterwards are inflated before they reach its
+ * file descriptor.
+ * @param   sink        Sink to decode into
+ * @param   encoding    Content encoding of body
+ * @return  true on success, otherwise false
+ **/
+bool    decode_init(Sink *sink, int encoding) {
+    if (encoding != ENCODING_GZIP && encoding != ENCODING_DEFLATE) {
+        fprintf(stderr, "Unable to decode body: unsupported Content-Encoding\n");
+        return false;
+    }
+
+    Decoder *d = calloc(1, sizeof(Decoder));
+    if (d == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Detect zlib or gzip header automatically
+    if (inflateInit2(&d->stream, MAX_WBITS + 32) != Z_OK) {
+        fprintf(stderr, "Unable to initialize decoder\n");
+        free(d);
+        return false;
+    }
+    d->encoding   = encoding;
+    sink->decoder = d;
+    return true;
+}
+
+/**
+ * Inflate encoded bytes and write them to sink.
+ * @param   sink        Sink with decoder attached
+ * @param   data        Encoded bytes
+ * @param   size        Number of encoded bytes
+ * @return  true if bytes were decoded and written, otherwise false
+ **/
+bool    decode_write(Sink *sink, const char *data, size_t size) {
+    Decoder  *d = sink->decoder;
+    z_stream *z = &d->stream;
+
+    z->next_in  = (Bytef *)data;
+    z->avail_in = size;
+    do {
+        // Gzip bodies may hold several members; anything else after the end is ignored
+        if (d->ended) {
+            if (d->encoding != ENCODING_GZIP || inflateReset(z) != Z_OK) return true;
+            d->ended = false;
+        }
+
+        z->next_out  = (Bytef *)d->output;
+        z->avail_out = DECODE_BUFFER;
+
+        int status = inflate(z, Z_NO_FLUSH);
+        if (status == Z_DATA_ERROR && !d->started && d->encoding == ENCODING_DEFLATE) {
+            // Some servers send deflate without the zlib wrapper
+            if (inflateReset2(z, -MAX_WBITS) != Z_OK) return false;
+            d->started  = true;
+            z->next_in  = (Bytef *)data;
+            z->avail_in = size;
+            continue;
+        }
+        if (status == Z_STREAM_END) {
+            d->ended = true;
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            fprintf(stderr, "Unable to decode body: %s\n", z->msg ? z->msg : "corrupt data");
+            return false;
+        }
+        d->started = true;
+
+        size_t n = DECODE_BUFFER - z->avail_out;
+        if (n > 0 && !sink_output(sink, d->output, n)) return false;
+        if (status == Z_BUF_ERROR) break;
+    } while (z->avail_in > 0 || z->avail_out == 0);
+    return true;
+}
+
+/**
+ * Detach decoder from sink and release it.
+ * @param   sink        Sink with decoder attached
+ * @return  true if the encoded stream ended properly, otherwise false
+ **/
+bool    decode_end(Sink *sink) {
+    Decoder *d     = sink->decoder;
+    bool     ended = d->ended;
+
+    inflateEnd(&d->stream);
+    free(d);
+    sink->decoder = NULL;
+    return ended;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,575 @@
+/* execute.c: Parallel rename execution and cross-file-system moves */
+
+#define _GNU_SOURCE
+
+#include "moveit.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/* Structures */
+
+typedef struct {
+    char       *path;       // Directory path (NULL for unused entry)
+    size_t      length;     // Length of path
+    int         fd;         // O_PATH descriptor of directory
+} DirEntry;
+
+typedef struct {
+    DirEntry    entries[DIRCACHE_SIZE];
+    size_t      next;       // Entry replaced next
+} DirCache;
+
+typedef struct {
+    const char *path;       // Source of first operation
+    size_t      length;     // Length of directory part of path
+    size_t      start;      // First operation of sequence
+    size_t      end;        // Past last operation of sequence
+} Sequence;
+
+typedef struct {
+    size_t      start;      // First sequence of batch
+    size_t      end;        // Past last sequence of batch
+} Batch;
+
+typedef struct {
+    const Plan     *plan;       // Plan being executed
+    Journal        *journal;    // Journal operations are recorded in
+    Sequence       *sequences;  // Sequences, grouped by directory
+    Batch          *batches;    // Batches of sequences claimed by workers
+    size_t          nbatches;   // Number of batches
+    size_t          next;       // Next batch to claim
+    bool            failed;     // Whether any operation failed
+    bool            cached;     // Whether directory descriptors may be cached
+    pthread_mutex_t lock;       // Protects next and failed
+} Executor;
+
+/* Copy Functions */
+
+/**
+ * Copy contents of one open file to another.
+ *
+ * A reflink shares blocks when both names live on the same underlying file
+ * system (ie. bind mounts or btrfs subvolumes); otherwise the kernel copies
+ * the data with copy_file_range, and only if it cannot, the data passes
+ * through user space.
+ * @param   in          File descriptor to copy from.
+ * @param   out         File descriptor to copy to (empty).
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+static int copy_data(int in, int out) {
+    if (ioctl(out, FICLONE, in) == 0) return 0;
+
+    for (off_t copied = 0;; ) {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, 1<<30, 0);
+        if (n == 0) return 0;
+        if (n > 0) {
+            copied += n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (copied > 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)) return -1;
+        break;
+    }
+
+    char *buffer = malloc(COPY_BUFFER);
+    if (buffer == NULL) return -1;
+
+    ssize_t n;
+    while ((n = read(in, buffer, COPY_BUFFER)) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        for (ssize_t written = 0, m; written < n; written += m) {
+            m = write(out, buffer + written, n - written);
+            if (m < 0 && errno == EINTR) m = 0;
+            if (m < 0) {
+                n = -1;
+                break;
+            }
+        }
+        if (n < 0) break;
+    }
+
+    int saved = errno;
+    free(buffer);
+    errno = saved;
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * Copy regular file to new name, preserving mode, ownership, and times.
+ * @param   fromfd      Directory of source.
+ * @param   from        Name of source.
+ * @param   tofd        Directory of target.
+ * @param   to          Name of target (must not exist).
+ * @param   s           Status of source.
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+static int copy_file(int fromfd, const char *from, int tofd, const char *to, const struct stat *s) {
+    int in = openat(fromfd, from, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return -1;
+
+    int out = openat(tofd, to, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (out < 0) {
+        int saved = errno;
+        close(in);
+        errno = saved;
+        return -1;
+    }
+
+    struct timespec times[2] = {s->st_atim, s->st_mtim};
+    int status = copy_data(in, out);
+
+    // Ownership can only be kept by privileged users
+    if (status == 0 && fchown(out, s->st_uid, s->st_gid) < 0 && errno != EPERM) status = -1;
+    if (status == 0 && (fchmod(out, s->st_mode & 07777) < 0 || futimens(out, times) < 0)) status = -1;
+
+    int saved = errno;
+    close(in);
+    if (close(out) < 0 && status == 0) {
+        saved  = errno;
+        status = -1;
+    }
+    if (status < 0) unlinkat(tofd, to, 0);
+    errno = saved;
+    return status;
+}
+
+/**
+ * Copy symbolic link to new name, preserving ownership and times.
+ * @param   fromfd      Directory of source.
+ * @param   from        Name of source.
+ * @param   tofd        Directory of target.
+ * @param   to          Name of target (must not exist).
+ * @param   s           Status of source.
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+static int copy_link(int fromfd, const char *from, int tofd, const char *to, const struct stat *s) {
+    char    target[PATH_MAX];
+    ssize_t n = readlinkat(fromfd, from, target, sizeof(target) - 1);
+    if (n < 0) return -1;
+    target[n] = 0;
+    if (symlinkat(target, tofd, to) < 0) return -1;
+
+    // Ownership can only be kept by privileged users
+    struct timespec times[2] = {s->st_atim, s->st_mtim};
+    if ((fchownat(tofd, to, s->st_uid, s->st_gid, AT_SYMLINK_NOFOLLOW) < 0 && errno != EPERM) ||
+        utimensat(tofd, to, times, AT_SYMLINK_NOFOLLOW) < 0) {
+        int saved = errno;
+        unlinkat(tofd, to, 0);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Remove file or whole directory tree.
+ * @param   fd          Directory containing path.
+ * @param   name        Name of file or directory to remove.
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+static int remove_tree(int fd, const char *name) {
+    if (unlinkat(fd, name, 0) == 0) return 0;
+    if (errno != EISDIR) return -1;
+
+    int  in  = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = in < 0 ? NULL : fdopendir(in);
+    if (dir == NULL) {
+        int saved = errno;
+        if (in >= 0) close(in);
+        errno = saved;
+        return -1;
+    }
+
+    int status = 0;
+    for (;;) {
+        errno = 0;
+        struct dirent *entry = readdir(dir);
+        if (entry == NULL) {
+            if (errno) status = -1;
+            break;
+        }
+        if (streq(entry->d_name, ".") || streq(entry->d_name, "..")) continue;
+        if (remove_tree(in, entry->d_name) < 0) {
+            status = -1;
+            break;
+        }
+    }
+
+    int saved = errno;
+    closedir(dir);
+    errno = saved;
+    return status < 0 ? -1 : unlinkat(fd, name, AT_REMOVEDIR);
+}
+
+/**
+ * Copy file, symbolic link, or whole directory tree to new name, preserving
+ * mode, ownership, and times.  A partial copy is removed on failure.
+ * @param   fromfd      Directory of source.
+ * @param   from        Name of source.
+ * @param   tofd        Directory of target.
+ * @param   to          Name of target (must not exist).
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+static int copy_tree(int fromfd, const char *from, int tofd, const char *to) {
+    struct stat s;
+    if (fstatat(fromfd, from, &s, AT_SYMLINK_NOFOLLOW) < 0) return -1;
+
+    if (S_ISLNK(s.st_mode)) return copy_link(fromfd, from, tofd, to, &s);
+    if (S_ISREG(s.st_mode)) return copy_file(fromfd, from, tofd, to, &s);
+    if (!S_ISDIR(s.st_mode)) {
+        errno = EXDEV;      // Special files stay put
+        return -1;
+    }
+
+    if (mkdirat(tofd, to, 0700) < 0) return -1;
+
+    int  status = -1;
+    int  out    = openat(tofd, to, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int  in     = out < 0 ? -1 : openat(fromfd, from, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir    = in < 0 ? NULL : fdopendir(in);
+    if (dir != NULL) {
+        for (;;) {
+            errno = 0;
+            struct dirent *entry = readdir(dir);
+            if (entry == NULL) {
+                status = errno ? -1 : 0;
+                break;
+            }
+            if (streq(entry->d_name, ".") || streq(entry->d_name, "..")) continue;
+            if (copy_tree(in, entry->d_name, out, entry->d_name) < 0) break;
+        }
+    }
+
+    // Times go last, since filling the directory changed them
+    struct timespec times[2] = {s.st_atim, s.st_mtim};
+    if (status == 0 && fchown(out, s.st_uid, s.st_gid) < 0 && errno != EPERM) status = -1;
+    if (status == 0 && (fchmod(out, s.st_mode & 07777) < 0 || futimens(out, times) < 0)) status = -1;
+
+    int saved = errno;
+    if (dir != NULL) closedir(dir);
+    else if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    if (status < 0) remove_tree(tofd, to);
+    errno = saved;
+    return status;
+}
+
+/**
+ * Move file, symbolic link, or directory tree to another file system by
+ * copying it and removing the original.
+ *
+ * Should the original only partly be removed, the complete copy is kept so
+ * that nothing is lost.
+ * @param   fromfd      Directory of source.
+ * @param   from        Name of source.
+ * @param   tofd        Directory of target.
+ * @param   to          Name of target (must not exist).
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+static int move_across(int fromfd, const char *from, int tofd, const char *to) {
+    if (copy_tree(fromfd, from, tofd, to) < 0) return -1;
+
+    // Unlinking a file either fails whole or not at all
+    if (unlinkat(fromfd, from, 0) == 0) return 0;
+    if (errno != EISDIR) {
+        int saved = errno;
+        unlinkat(tofd, to, 0);
+        errno = saved;
+        return -1;
+    }
+    return remove_tree(fromfd, from);
+}
+
+/* Move Functions */
+
+/**
+ * Rename path without replacing an existing one, copying it when the target
+ * is on another file system.
+ * @param   fromfd      Directory of source (or AT_FDCWD).
+ * @param   from        Source, relative to fromfd.
+ * @param   tofd        Directory of target (or AT_FDCWD).
+ * @param   to          Target, relative to tofd (must not exist).
+ * @return  0 on success, otherwise -1 with errno set.
+ **/
+int     move_noreplace(int fromfd, const char *from, int tofd, const char *to) {
+    if (renameat2(fromfd, from, tofd, to, RENAME_NOREPLACE) == 0) return 0;
+    if (errno == EXDEV) return move_across(fromfd, from, tofd, to);
+    if (errno != EINVAL && errno != ENOSYS) return -1;
+
+    // File system cannot refuse atomically, so check first
+    struct stat s;
+    if (fstatat(tofd, to, &s, AT_SYMLINK_NOFOLLOW) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (renameat(fromfd, from, tofd, to) == 0) return 0;
+    return errno == EXDEV ? move_across(fromfd, from, tofd, to) : -1;
+}
+
+/**
+ * Swap two paths, falling back to a temporary name when the file system
+ * cannot exchange them atomically.
+ * @param   journal     Journal to record operations in.
+ * @param   a           First path.
+ * @param   b           Second path.
+ * @return  Whether or not the paths were swapped.
+ **/
+bool    move_exchange(Journal *journal, const char *a, const char *b) {
+    if (renameat2(AT_FDCWD, a, AT_FDCWD, b, RENAME_EXCHANGE) == 0) {
+        return journal_record(journal, OP_EXCHANGE, a, b);
+    }
+    if (errno != EINVAL && errno != ENOSYS && errno != EXDEV) {
+        fprintf(stderr, "Unable to exchange %s and %s: %s\n", a, b, strerror(errno));
+        return false;
+    }
+
+    // Park a next to itself under a name nothing else uses
+    char temp[BUFSIZ + 64];
+    int  status = -1;
+    for (unsigned n = 0; status < 0 && n < 100; n++) {
+        if ((size_t)snprintf(temp, sizeof(temp), "%s.moveit-%d-%u", a, getpid(), n) >= sizeof(temp)) break;
+        status = move_noreplace(AT_FDCWD, a, AT_FDCWD, temp);
+        if (status < 0 && errno != EEXIST) break;
+    }
+    if (status < 0) {
+        fprintf(stderr, "Unable to rename %s to temporary name: %s\n", a, strerror(errno));
+        return false;
+    }
+    if (!journal_record(journal, OP_RENAME, a, temp)) return false;
+
+    const char *steps[][2] = {{b, a}, {temp, b}};
+    for (size_t i = 0; i < 2; i++) {
+        if (move_noreplace(AT_FDCWD, steps[i][0], AT_FDCWD, steps[i][1]) < 0) {
+            fprintf(stderr, "Unable to rename %s to %s: %s\n", steps[i][0], steps[i][1], strerror(errno));
+            return false;
+        }
+        if (!journal_record(journal, OP_RENAME, steps[i][0], steps[i][1])) return false;
+    }
+    return true;
+}
+
+/* Directory Cache Functions */
+
+/**
+ * Return descriptor of directory containing path, opening it on first use.
+ * @param   cache       Directory cache (NULL to resolve paths from cwd).
+ * @param   path        Path of file.
+ * @param   name        Set to name of file relative to returned descriptor.
+ * @param   keep        Descriptor that must not be evicted.
+ * @return  Directory descriptor (or AT_FDCWD), otherwise -1 with errno set.
+ **/
+static int dircache_open(DirCache *cache, const char *path, const char **name, int keep) {
+    const char *slash = strrchr(path, '/');
+    if (cache == NULL || slash == NULL) {
+        *name = path;
+        return AT_FDCWD;
+    }
+
+    *name = slash + 1;
+    size_t length = slash == path ? 1 : (size_t)(slash - path);
+    for (size_t i = 0; i < DIRCACHE_SIZE; i++) {
+        DirEntry *e = &cache->entries[i];
+        if (e->path && e->length == length && memcmp(e->path, path, length) == 0) return e->fd;
+    }
+
+    char *dir = strndup(path, length);
+    if (dir == NULL) return -1;
+    int fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        free(dir);
+        return -1;
+    }
+
+    if (cache->entries[cache->next].path && cache->entries[cache->next].fd == keep) {
+        cache->next = (cache->next + 1) % DIRCACHE_SIZE;
+    }
+    DirEntry *e = &cache->entries[cache->next];
+    if (e->path) {
+        close(e->fd);
+        free(e->path);
+    }
+    *e = (DirEntry){dir, length, fd};
+    cache->next = (cache->next + 1) % DIRCACHE_SIZE;
+    return fd;
+}
+
+/**
+ * Close every cached directory descriptor.
+ * @param   cache       Directory cache.
+ **/
+static void dircache_close(DirCache *cache) {
+    for (size_t i = 0; i < DIRCACHE_SIZE; i++) {
+        if (cache->entries[i].path == NULL) continue;
+        close(cache->entries[i].fd);
+        free(cache->entries[i].path);
+    }
+}
+
+/* Execute Functions */
+
+/**
+ * Order sequences by directory of their first source, then by position.
+ * @param   a           First sequence.
+ * @param   b           Second sequence.
+ * @return  Negative, zero, or positive as a sorts before, with, or after b.
+ **/
+static int sequence_compare(const void *a, const void *b) {
+    const Sequence *s = a, *t = b;
+    int c = memcmp(s->path, t->path, s->length < t->length ? s->length : t->length);
+    if (c) return c;
+    if (s->length != t->length) return s->length < t->length ? -1 : 1;
+    return s->start < t->start ? -1 : s->start > t->start;
+}
+
+/**
+ * Perform single planned operation on cached directory descriptors.
+ * @param   e           Executor.
+ * @param   cache       Directory cache of worker (NULL to use full paths).
+ * @param   op          Operation to perform.
+ * @return  Whether or not the operation was performed and recorded.
+ **/
+static bool execute_operation(Executor *e, DirCache *cache, const Operation *op) {
+    if (op->kind == OP_EXCHANGE) return move_exchange(e->journal, op->from, op->to);
+
+    const char *from, *to;
+    int fromfd = dircache_open(cache, op->from, &from, -1);
+    int tofd   = fromfd == -1 ? -1 : dircache_open(cache, op->to, &to, fromfd);
+    if (fromfd == -1 || tofd == -1) {
+        fprintf(stderr, "Unable to open directory of %s: %s\n", fromfd == -1 ? op->from : op->to, strerror(errno));
+        return false;
+    }
+
+    if (move_noreplace(fromfd, from, tofd, to) < 0) {
+        fprintf(stderr, "Unable to rename %s to %s: %s\n", op->from, op->to, strerror(errno));
+        return false;
+    }
+    return journal_record(e->journal, OP_RENAME, op->from, op->to);
+}
+
+/**
+ * Claim batches of sequences and perform them until none are left or any
+ * operation fails.
+ * @param   arg         Pointer to executor.
+ * @return  NULL
+ **/
+static void *execute_worker(void *arg) {
+    Executor *e     = arg;
+    DirCache  cache = {0};
+
+    for (;;) {
+        pthread_mutex_lock(&e->lock);
+        bool   done  = e->failed || e->next == e->nbatches;
+        size_t batch = e->next;
+        if (!done) e->next++;
+        pthread_mutex_unlock(&e->lock);
+        if (done) break;
+
+        Batch *b = &e->batches[batch];
+        for (size_t i = b->start; i < b->end; i++) {
+            Sequence *s = &e->sequences[i];
+            for (size_t j = s->start; j < s->end; j++) {
+                if (execute_operation(e, e->cached ? &cache : NULL, &e->plan->operations.data[j])) continue;
+
+                pthread_mutex_lock(&e->lock);
+                e->failed = true;
+                pthread_mutex_unlock(&e->lock);
+                goto finish;
+            }
+        }
+    }
+
+finish:
+    dircache_close(&cache);
+    return NULL;
+}
+
+/**
+ * Perform planned operations, recording each in journal.
+ *
+ * Independent sequences are grouped by the directory of their first source
+ * and handed out in batches to worker threads, each of which resolves names
+ * relative to its own cache of directory descriptors.  Plans where some path
+ * lies inside a renamed directory run in order on a single thread with full
+ * paths instead.
+ * @param   plan        Plan to perform.
+ * @param   journal     Journal to record operations in.
+ * @param   threads     Maximum number of worker threads.
+ * @return  Whether or not every operation was performed.
+ **/
+bool    plan_execute(const Plan *plan, Journal *journal, int threads) {
+    size_t nsequences = plan->nsequences;
+    if (nsequences == 0) return true;
+
+    Sequence *sequences = calloc(nsequences, sizeof(Sequence));
+    Batch    *batches   = calloc(nsequences, sizeof(Batch));
+    if (sequences == NULL || batches == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        free(sequences);
+        free(batches);
+        return false;
+    }
+
+    for (size_t i = 0; i < nsequences; i++) {
+        Sequence   *s     = &sequences[i];
+        const char *slash;
+        s->start  = plan->sequences[i];
+        s->end    = i + 1 < nsequences ? plan->sequences[i + 1] : plan->operations.size;
+        s->path   = plan->operations.data[s->start].from;
+        s->length = (slash = strrchr(s->path, '/')) ? (size_t)(slash - s->path) : 0;
+    }
+    if (plan->nested) {
+        threads = 1;
+    } else {
+        qsort(sequences, nsequences, sizeof(Sequence), sequence_compare);
+    }
+
+    // Batch consecutive sequences of the same directory
+    size_t nbatches = 0, operations = 0;
+    for (size_t i = 0; i < nsequences; i++) {
+        Sequence *s     = &sequences[i];
+        Sequence *first = nbatches ? &sequences[batches[nbatches - 1].start] : NULL;
+        if (first == NULL || operations >= EXECUTE_BATCH || first->length != s->length || memcmp(first->path, s->path, s->length) != 0) {
+            batches[nbatches++] = (Batch){i, i};
+            operations = 0;
+        }
+        batches[nbatches - 1].end = i + 1;
+        operations += s->end - s->start;
+    }
+
+    Executor e = {plan, journal, sequences, batches, nbatches, 0, false, !plan->nested};
+    pthread_mutex_init(&e.lock, NULL);
+
+    // Calling thread is one of the workers
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > nbatches) threads = nbatches;
+
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    int        started = 0;
+    for (int i = 1; workers && i < threads; i++) {
+        if ((errno = pthread_create(&workers[started], NULL, execute_worker, &e)) != 0) {
+            fprintf(stderr, "Unable to pthread_create: %s\n", strerror(errno));
+            break;
+        }
+        started++;
+    }
+    execute_worker(&e);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&e.lock);
+    free(workers);
+    free(sequences);
+    free(batches);
+    return !e.failed;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,359 @@
+/* fetch.c: HTTP/1.1 requests over pooled connections */
+
+#define _GNU_SOURCE
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/* Functions */
+
+/**
+ * Write all bytes to sink's file descriptor, advancing its offset when it is
+ * positional.  Bytes written to a sink without a file descriptor are
+ * discarded.
+ * @param   sink        Sink to write to
+ * @param   data        Bytes to write
+ * @param   size        Number of bytes to write
+ * @return  true if every byte was written, otherwise false
+ **/
+bool sink_output(Sink *sink, const char *data, size_t size) {
+    if (sink->fd < 0) return true;
+
+    while (size > 0) {
+        ssize_t n = sink->offset < 0 ? write(sink->fd, data, size) : pwrite(sink->fd, data, size, sink->offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "Unable to write: %s\n", strerror(errno));
+            return false;
+        }
+        if (sink->offset >= 0) sink->offset += n;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * Write body bytes to sink, decoding them first if the body is encoded.
+ * @param   sink        Sink to write to
+ * @param   data        Bytes to write
+ * @param   size        Number of bytes to write
+ * @return  true if every byte was written, otherwise false
+ **/
+bool sink_write(Sink *sink, const char *data, size_t size) {
+    return sink->decoder ? decode_write(sink, data, size) : sink_output(sink, data, size);
+}
+
+/**
+ * Format request for URL.
+ * @param   buffer      Buffer to format request into
+ * @param   size        Size of buffer
+ * @param   url         URL to request
+ * @param   method      Request method (ie. GET or HEAD)
+ * @param   headers     Additional CRLF-terminated header lines
+ * @return  Length of request, or -1 if it does not fit
+ **/
+int request_format(char *buffer, size_t size, const URL *url, const char *method, const char *headers) {
+    int n = snprintf(buffer, size,
+        "%s /%s HTTP/1.1\r\n"
+        "Host: %s%s%s\r\n"
+        "User-Agent: curlit\r\n"
+        "%s"
+        "\r\n",
+        method, url->path,
+        url->host, streq(url->port, "80") ? "" : ":", streq(url->port, "80") ? "" : url->port,
+        headers);
+    return (n < 0 || (size_t)n >= size) ? -1 : n;
+}
+
+/**
+ * Send request for URL.
+ * @param   c           Connection to send on
+ * @param   url         URL to request
+ * @param   method      Request method (ie. GET or HEAD)
+ * @param   headers     Additional CRLF-terminated header lines
+ * @return  true if request was sent, otherwise false
+ **/
+static bool send_request(Connection *c, const URL *url, const char *method, const char *headers) {
+    char request[2*BUFSIZ + PATH_MAX];
+    int  n = request_format(request, sizeof(request), url, method, headers);
+    if (n < 0) return false;
+
+    c->requests++;
+    return connection_send(c, request, n);
+}
+
+/**
+ * Read status line and headers of response.
+ * @param   c           Connection to read from
+ * @param   r           Response parser
+ * @return  1 on success, 0 if connection ended before any byte of the
+ * response, -1 on malformed or truncated response
+ **/
+static int read_head(Connection *c, Response *r) {
+    bool received = false;
+    while (!http_head_done(r)) {
+        if (c->start == c->end) {
+            ssize_t n = connection_fill(c);
+            if (n <= 0) return received ? -1 : 0;
+        }
+        if (!received) r->received = timing_now();
+        received = true;
+
+        ssize_t n = http_parse_head(r, c->buffer + c->start, c->end - c->start);
+        if (n < 0) return -1;
+        c->start += n;
+    }
+    return 1;
+}
+
+/**
+ * Return connection's page-aligned transfer buffer, allocating it on first use.
+ * @param   c           Connection
+ * @return  Buffer of TRANSFER_BUFFER bytes, or NULL on failure
+ **/
+static char *transfer_buffer(Connection *c) {
+    if (c->transfer == NULL && posix_memalign((void **)&c->transfer, sysconf(_SC_PAGESIZE), TRANSFER_BUFFER) != 0) {
+        c->transfer = NULL;
+    }
+    return c->transfer;
+}
+
+/**
+ * Receive body bytes into connection's transfer buffer and write them to sink.
+ * @param   c           Connection to read from
+ * @param   sink        Sink to write to
+ * @param   size        Maximum number of bytes to move
+ * @return  Number of bytes moved, 0 on end of stream, -1 on error
+ **/
+static ssize_t recv_body(Connection *c, Sink *sink, size_t size) {
+    if (transfer_buffer(c) == NULL) return -1;
+
+    ssize_t n;
+    do {
+        n = recv(c->fd, c->transfer, size < TRANSFER_BUFFER ? size : TRANSFER_BUFFER, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0 && !sink_write(sink, c->transfer, n)) return -1;
+    return n;
+}
+
+/**
+ * Move body bytes from socket to sink through the connection's pipe, so they
+ * never pass through user space.
+ *
+ * If the sink cannot be spliced into (ie. a terminal or a file opened for
+ * appending), the sink is marked for copying and whatever was already moved
+ * into the pipe is copied out of it.
+ * @param   c           Connection to read from
+ * @param   sink        Sink to write to
+ * @param   size        Maximum number of bytes to move
+ * @return  Number of bytes moved, 0 on end of stream, -1 on error
+ **/
+static ssize_t splice_body(Connection *c, Sink *sink, size_t size) {
+    if (c->pipe[0] < 0) {
+        if (pipe2(c->pipe, O_CLOEXEC) < 0) {
+            sink->copy = true;
+            return recv_body(c, sink, size);
+        }
+        fcntl(c->pipe[1], F_SETPIPE_SZ, PIPE_SIZE);     // Best effort
+    }
+
+    ssize_t n;
+    do {
+        n = splice(c->fd, NULL, c->pipe[1], NULL, size < PIPE_SIZE ? size : PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno == EINVAL) {
+        sink->copy = true;
+        return recv_body(c, sink, size);
+    }
+    if (n <= 0) return n;
+
+    // Drain pipe into sink
+    size_t left = n;
+    while (left > 0) {
+        loff_t  offset = sink->offset;
+        ssize_t m      = splice(c->pipe[0], NULL, sink->fd, sink->offset < 0 ? NULL : &offset, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (m < 0 && errno == EINTR) continue;
+        if (m < 0 && errno == EINVAL) {
+            sink->copy = true;
+            break;
+        }
+        if (m <= 0) return -1;
+        if (sink->offset >= 0) sink->offset += m;
+        left -= m;
+    }
+
+    while (left > 0) {
+        if (transfer_buffer(c) == NULL) return -1;
+
+        ssize_t m = read(c->pipe[0], c->transfer, left < TRANSFER_BUFFER ? left : TRANSFER_BUFFER);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0 || !sink_write(sink, c->transfer, m)) return -1;
+        left -= m;
+    }
+    return n;
+}
+
+/**
+ * Copy response body from connection to sink.
+ *
+ * Buffered bytes are run through the parser, which strips chunked framing.
+ * Payload runs of at least SPLICE_MINIMUM bytes that are not buffered yet are
+ * spliced from the socket to the sink, or received in large blocks when
+ * splicing is not possible (or the body must be decoded on the way).
+ * @param   c           Connection to read from
+ * @param   r           Response parser positioned at the body
+ * @param   sink        Sink to write to
+ * @param   stats       Transfer statistics to update
+ * @return  true if the whole body was copied, otherwise false
+ **/
+static bool copy_body(Connection *c, Response *r, Sink *sink, Stats *stats) {
+    while (!http_done(r)) {
+        ssize_t n;
+        if (c->start < c->end) {
+            size_t payload, npayload;
+            n = http_parse_body(r, c->buffer + c->start, c->end - c->start, &payload, &npayload);
+            if (n < 0) {
+                fprintf(stderr, "Unable to parse body: malformed chunk\n");
+                return false;
+            }
+            if (npayload > 0 && !sink_write(sink, c->buffer + c->start + payload, npayload)) return false;
+            c->start     += n;
+            stats->bytes += npayload;
+            continue;
+        }
+
+        uint64_t remaining = http_body_remaining(r);
+        if (remaining >= SPLICE_MINIMUM) {
+            n = sink->fd >= 0 && !sink->copy && !sink->decoder ? splice_body(c, sink, remaining) : recv_body(c, sink, remaining);
+            if (n > 0) {
+                http_body_consumed(r, n);
+                stats->bytes += n;
+                continue;
+            }
+        } else {
+            n = connection_fill(c);
+            if (n > 0) continue;
+        }
+
+        if (n < 0) {
+            fprintf(stderr, "Unable to transfer body: %s\n", strerror(errno));
+            return false;
+        }
+        if (!http_body_eof(r)) {
+            fprintf(stderr, "Unable to transfer body: connection closed early\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Send request for URL and read the head of its response.
+ *
+ * The connection is taken from the pool.  If a reused connection turns out to
+ * have been closed by the server before answering, the request is retried
+ * once on a fresh connection.
+ * @param   pool        Connection pool
+ * @param   url         URL to request
+ * @param   method      Request method (ie. GET or HEAD)
+ * @param   headers     Additional CRLF-terminated header lines
+ * @param   r           Response to fill
+ * @return  Connection positioned at the response body, or NULL on failure
+ **/
+Connection *request_open(Pool *pool, const URL *url, const char *method, const char *headers, Response *r) {
+    uint64_t started = timing_now();
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        Connection *c = pool_acquire(pool, url);
+        if (c == NULL) return NULL;
+
+        http_init(r, streq(method, "HEAD"));
+        r->started = started;
+        r->timing[PHASE_RESOLVE] = c->requests ? 0 : c->resolved;
+        r->timing[PHASE_CONNECT] = c->requests ? 0 : c->connected;
+
+        // Time spent writing and waiting for the first byte of the response
+        bool     reused  = c->requests > 0;
+        uint64_t writing = timing_now();
+        bool     sent    = send_request(c, url, method, headers);
+        uint64_t written = timing_now();
+        int      status  = sent ? read_head(c, r) : 0;
+        r->timing[PHASE_WRITE]      = written - writing;
+        r->timing[PHASE_FIRST_BYTE] = status > 0 ? r->received - written : 0;
+        if (status == 0 && reused) {
+            pool_release(pool, c, false);
+            continue;
+        }
+        if (status <= 0) {
+            fprintf(stderr, "Unable to read response from %s:%s\n", url->host, url->port);
+            pool_release(pool, c, false);
+            return NULL;
+        }
+        return c;
+    }
+    return NULL;
+}
+
+/**
+ * Read body of response into sink and return connection to pool.
+ * @param   pool        Connection pool
+ * @param   c           Connection returned by request_open
+ * @param   r           Response returned by request_open
+ * @param   sink        Sink to write body to (NULL to discard it)
+ * @param   stats       Transfer statistics to update
+ * @return  true if the whole body was read, otherwise false
+ **/
+bool        request_body(Pool *pool, Connection *c, Response *r, Sink *sink, Stats *stats) {
+    Sink discard = {-1, -1};
+    if (sink == NULL) sink = &discard;
+
+    // Encoded bodies are inflated as they arrive; discarded ones are not
+    bool success = true;
+    if (r->body && sink->fd >= 0 && r->encoding != ENCODING_IDENTITY) success = decode_init(sink, r->encoding);
+    if (success) success = copy_body(c, r, sink, stats);
+    if (sink->decoder && !decode_end(sink) && success) {
+        fprintf(stderr, "Unable to decode body: stream truncated\n");
+        success = false;
+    }
+
+    uint64_t finished = timing_now();
+    r->timing[PHASE_TRANSFER] = finished - r->received;
+    r->timing[PHASE_TOTAL]    = finished - r->started;
+
+    stats->requests++;
+    if (stats->phases) timing_record(stats->phases, r);
+    pool_release(pool, c, success && r->keep_alive);
+    return success;
+}
+
+/**
+ * Fetch contents of URL and write body to sink.
+ * @param   pool        Connection pool
+ * @param   url         Pointer to URL structure
+ * @param   sink        Sink to write body to
+ * @param   stats       Transfer statistics to update
+ * @return  true if client is able to read all of the content of a successful
+ * response, otherwise false
+ **/
+bool    fetch_url(Pool *pool, URL *url, Sink *sink, Stats *stats) {
+    Response    r;
+    Connection *c = request_open(pool, url, "GET", ACCEPT_ENCODING, &r);
+    if (c == NULL) return false;
+
+    bool ok = r.status / 100 == 2;
+    if (!ok) {
+        fprintf(stderr, "Unable to fetch %s:%s/%s: status %d\n", url->host, url->port, url->path, r.status);
+    }
+    return request_body(pool, c, &r, ok ? sink : NULL, stats) && ok;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,113 @@
+/* histogram.c: Log-linear latency histogram */
+
+#include "histogram.h"
+
+#include <string.h>
+
+/* Bucket Functions */
+
+/**
+ * Map value to bucket.
+ *
+ * Values below HISTOGRAM_LINEAR get their own bucket; above it, every power
+ * of two is split into HISTOGRAM_SUB buckets, which bounds the relative
+ * error of any reported value to about 1.5%.
+ * @param   value       Value to map
+ * @return  Bucket index
+ **/
+static size_t bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_LINEAR) return value;
+
+    int exponent = 63 - __builtin_clzll(value);     /* >= 7 */
+    int shift    = exponent - 6;                    /* Keep 7 significant bits */
+    return HISTOGRAM_LINEAR + (exponent - 7) * HISTOGRAM_SUB + ((value >> shift) - HISTOGRAM_SUB);
+}
+
+/**
+ * Return largest value that maps to bucket.
+ * @param   index       Bucket index
+ * @return  Upper bound of bucket
+ **/
+static uint64_t bucket_value(size_t index) {
+    if (index < HISTOGRAM_LINEAR) return index;
+
+    size_t   offset   = index - HISTOGRAM_LINEAR;
+    int      shift    = offset / HISTOGRAM_SUB + 1;
+    uint64_t mantissa = offset % HISTOGRAM_SUB + HISTOGRAM_SUB;
+    return (mantissa << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+/* Functions */
+
+/**
+ * Initialize empty histogram.
+ * @param   h           Pointer to histogram
+ **/
+void histogram_init(Histogram *h) {
+    memset(h, 0, sizeof(Histogram));
+    h->min = UINT64_MAX;
+}
+
+/**
+ * Record value in histogram.
+ * @param   h           Pointer to histogram
+ * @param   value       Value to record
+ **/
+void histogram_record(Histogram *h, uint64_t value) {
+    h->counts[bucket_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+/**
+ * Add values recorded in other histogram to histogram.
+ * @param   h           Pointer to histogram to add to
+ * @param   other       Pointer to histogram to add from
+ **/
+void histogram_merge(Histogram *h, const Histogram *other) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) h->counts[i] += other->counts[i];
+    h->total += other->total;
+    h->sum   += other->sum;
+    if (other->min < h->min) h->min = other->min;
+    if (other->max > h->max) h->max = other->max;
+}
+
+/**
+ * Return value at percentile.
+ * @param   h           Pointer to histogram
+ * @param   percentile  Percentile in [0, 100]
+ * @return  Value at or below which the given percentage of values fall
+ * (0 if histogram is empty)
+ **/
+uint64_t histogram_percentile(const Histogram *h, double percentile) {
+    if (h->total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * h->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->total) rank = h->total;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            if (value > h->max) value = h->max;
+            if (value < h->min) value = h->min;
+            return value;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * Return mean of recorded values.
+ * @param   h           Pointer to histogram
+ * @return  Mean value (0 if histogram is empty)
+ **/
+double histogram_mean(const Histogram *h) {
+    return h->total ? h->sum / h->total : 0;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
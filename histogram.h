@@ -0,0 +1,32 @@
+/* histogram.h: Log-linear latency histogram */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Constants */
+
+#define HISTOGRAM_LINEAR    128     /* Values recorded exactly below this */
+#define HISTOGRAM_SUB       64      /* Buckets per power of two above it */
+#define HISTOGRAM_BUCKETS   (HISTOGRAM_LINEAR + (64 - 7) * HISTOGRAM_SUB)
+
+/* Histogram Structure */
+
+typedef struct {
+    uint64_t    counts[HISTOGRAM_BUCKETS];  // Number of values per bucket
+    uint64_t    total;                      // Number of values recorded
+    uint64_t    min;                        // Smallest value recorded
+    uint64_t    max;                        // Largest value recorded
+    double      sum;                        // Sum of values recorded
+} Histogram;
+
+/* Functions */
+
+void        histogram_init(Histogram *h);
+void        histogram_record(Histogram *h, uint64_t value);
+void        histogram_merge(Histogram *h, const Histogram *other);
+uint64_t    histogram_percentile(const Histogram *h, double percentile);
+double      histogram_mean(const Histogram *h);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
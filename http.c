@@ -0,0 +1,476 @@
+/* http.c: Incremental HTTP/1.x response parser */
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Parser States */
+
+enum {
+    STATE_VERSION,          // Protocol version (ie. HTTP/1.1)
+    STATE_STATUS,           // Status code digits
+    STATE_REASON,           // Reason phrase up to end of line
+    STATE_HEADER_START,     // Start of header line or blank line
+    STATE_HEADER_NAME,      // Header name up to colon
+    STATE_HEADER_VALUE,     // Header value up to end of line
+    STATE_HEAD_END,         // CR of blank line seen, LF expected
+    STATE_BODY_LENGTH,      // Body delimited by Content-Length
+    STATE_BODY_EOF,         // Body delimited by end of stream
+    STATE_CHUNK_SIZE,       // Hexadecimal chunk size
+    STATE_CHUNK_EXTENSION,  // Chunk extension up to end of line
+    STATE_CHUNK_DATA,       // Chunk payload
+    STATE_CHUNK_END,        // CRLF after chunk payload
+    STATE_TRAILER_START,    // Start of trailer line or blank line
+    STATE_TRAILER,          // Trailer line up to end of line
+    STATE_DONE,             // Response complete
+    STATE_ERROR,            // Malformed response
+};
+
+/* Headers Of Interest */
+
+enum {
+    HEADER_OTHER,
+    HEADER_CONTENT_LENGTH,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_CONNECTION,
+    HEADER_ACCEPT_RANGES,
+    HEADER_CONTENT_RANGE,
+    HEADER_ETAG,
+    HEADER_LAST_MODIFIED,
+    HEADER_CONTENT_ENCODING,
+};
+
+static const struct {
+    const char *name;
+    int         id;
+} Headers[] = {
+    {"Content-Length",      HEADER_CONTENT_LENGTH},
+    {"Transfer-Encoding",   HEADER_TRANSFER_ENCODING},
+    {"Connection",          HEADER_CONNECTION},
+    {"Accept-Ranges",       HEADER_ACCEPT_RANGES},
+    {"Content-Range",       HEADER_CONTENT_RANGE},
+    {"ETag",                HEADER_ETAG},
+    {"Last-Modified",       HEADER_LAST_MODIFIED},
+    {"Content-Encoding",    HEADER_CONTENT_ENCODING},
+};
+
+#define NHEADERS    (sizeof(Headers) / sizeof(Headers[0]))
+
+/* Internal Functions */
+
+/**
+ * Determine whether comma-separated header value contains token.
+ * @param   value       Header value (ie. "keep-alive, Upgrade")
+ * @param   token       Token to look for (case-insensitive)
+ * @return  true if value lists token, otherwise false
+ **/
+static bool has_token(const char *value, const char *token) {
+    size_t length = strlen(token);
+    while (*value) {
+        value += strspn(value, " \t,");
+        size_t n = strcspn(value, " \t,;");
+        if (n == length && strncasecmp(value, token, length) == 0) return true;
+        value += n;
+        value += strcspn(value, ",");
+    }
+    return false;
+}
+
+/**
+ * Parse non-negative decimal integer that must fill the whole string.
+ * @param   s           String to parse
+ * @param   value       Pointer to integer to store
+ * @return  true if string is a valid integer that fits, otherwise false
+ **/
+static bool parse_length(const char *s, int64_t *value) {
+    if (*s < '0' || *s > '9') return false;
+
+    char *end;
+    errno = 0;
+    long long n = strtoll(s, &end, 10);
+    if (errno || *end) return false;
+    *value = n;
+    return true;
+}
+
+/**
+ * Reset fields describing the response head.
+ * @param   r           Response parser
+ **/
+static void http_reset(Response *r) {
+    r->state      = STATE_VERSION;
+    r->status     = 0;
+    r->minor      = 0;
+    r->length     = -1;
+    r->chunked    = false;
+    r->keep_alive = false;
+    r->ranges     = false;
+    r->offset     = -1;
+    r->total      = -1;
+    r->body       = false;
+    r->encoding   = ENCODING_IDENTITY;
+    r->nname      = 0;
+    r->nvalue     = 0;
+
+    r->etag[0]     = '\0';
+    r->modified[0] = '\0';
+}
+
+/**
+ * Interpret value of completed header line.
+ * @param   r           Response parser
+ * @return  true if header is acceptable, otherwise false
+ **/
+static bool http_header(Response *r) {
+    // Strip trailing whitespace
+    while (r->nvalue > 0 && (r->value[r->nvalue - 1] == ' ' || r->value[r->nvalue - 1] == '\t')) r->nvalue--;
+    r->value[r->nvalue] = '\0';
+
+    char *value = r->value;
+    switch (r->header) {
+        case HEADER_CONTENT_LENGTH: {
+            int64_t length;
+            if (r->truncated || !parse_length(value, &length)) return false;
+            if (r->length >= 0 && r->length != length) return false;
+            r->length = length;
+            break;
+        }
+        case HEADER_TRANSFER_ENCODING:
+            r->chunked = has_token(value, "chunked");
+            break;
+        case HEADER_CONNECTION:
+            if (has_token(value, "close"))      r->keep_alive = false;
+            if (has_token(value, "keep-alive")) r->keep_alive = true;
+            break;
+        case HEADER_ACCEPT_RANGES:
+            r->ranges = has_token(value, "bytes");
+            break;
+        case HEADER_CONTENT_RANGE: {
+            long long first, last, total;
+            if (sscanf(value, "bytes %lld-%lld/%lld", &first, &last, &total) == 3) {
+                r->offset = first;
+                r->total  = total;
+            } else if (sscanf(value, "bytes */%lld", &total) == 1) {
+                // Unsatisfied range (416) only carries the complete length
+                r->total  = total;
+            }
+            break;
+        }
+        case HEADER_ETAG:
+            if (!r->truncated) memcpy(r->etag, value, r->nvalue + 1);
+            break;
+        case HEADER_LAST_MODIFIED:
+            if (!r->truncated) memcpy(r->modified, value, r->nvalue + 1);
+            break;
+        case HEADER_CONTENT_ENCODING:
+            // Only a single gzip or deflate coding can be decoded
+            if (strchr(value, ',')) {
+                r->encoding = ENCODING_UNKNOWN;
+            } else if (has_token(value, "gzip") || has_token(value, "x-gzip")) {
+                r->encoding = ENCODING_GZIP;
+            } else if (has_token(value, "deflate")) {
+                r->encoding = ENCODING_DEFLATE;
+            } else if (*value && !has_token(value, "identity")) {
+                r->encoding = ENCODING_UNKNOWN;
+            }
+            break;
+    }
+    return true;
+}
+
+/**
+ * Decide how body is delimited once the blank line ending the head is read.
+ * @param   r           Response parser
+ **/
+static void http_head_end(Response *r) {
+    // Interim responses are followed by the real one
+    if (r->status / 100 == 1) {
+        bool head = r->head;
+        http_reset(r);
+        r->head = head;
+        return;
+    }
+
+    r->body = !r->head && r->status != 204 && r->status != 304;
+    if (!r->body) {
+        r->state = STATE_DONE;
+    } else if (r->chunked) {
+        r->state = STATE_CHUNK_SIZE;
+        r->chunk = 0;
+        r->nname = 0;
+    } else if (r->length >= 0) {
+        r->state = r->length ? STATE_BODY_LENGTH : STATE_DONE;
+        r->chunk = r->length;
+    } else {
+        r->state      = STATE_BODY_EOF;
+        r->keep_alive = false;
+    }
+}
+
+/* Functions */
+
+/**
+ * Initialize parser for response to a request.
+ * @param   r           Response parser
+ * @param   head        Whether the request was HEAD (response has no body)
+ **/
+void    http_init(Response *r, bool head) {
+    http_reset(r);
+    r->head = head;
+}
+
+/**
+ * Consume bytes of the response head (status line and headers).
+ *
+ * Bytes are consumed in place and may be split anywhere; only the values of
+ * headers the client uses are kept, in fixed buffers within the parser.
+ * Parsing stops right after the blank line ending the head, so any body
+ * bytes that follow are left unconsumed.
+ * @param   r           Response parser
+ * @param   data        Bytes received
+ * @param   size        Number of bytes received
+ * @return  Number of bytes consumed, or -1 if the response is malformed
+ **/
+ssize_t http_parse_head(Response *r, const char *data, size_t size) {
+    size_t i = 0;
+    for (; i < size && !http_head_done(r); i++) {
+        char ch = data[i];
+        switch (r->state) {
+            case STATE_VERSION:
+                if (ch == ' ') {
+                    r->name[r->nname] = '\0';
+                    if (sscanf(r->name, "HTTP/1.%d", &r->minor) != 1) goto error;
+                    r->keep_alive = r->minor >= 1;
+                    r->state      = STATE_STATUS;
+                    r->nname      = 0;
+                } else if (r->nname + 1 < HTTP_NAME_MAX) {
+                    r->name[r->nname++] = ch;
+                } else {
+                    goto error;
+                }
+                break;
+
+            case STATE_STATUS:
+                if (ch >= '0' && ch <= '9' && r->nname < 3) {
+                    r->status = r->status * 10 + (ch - '0');
+                    r->nname++;
+                } else if (r->nname == 3 && (ch == ' ' || ch == '\r' || ch == '\n')) {
+                    r->state = ch == '\n' ? STATE_HEADER_START : STATE_REASON;
+                } else {
+                    goto error;
+                }
+                break;
+
+            case STATE_REASON:
+                if (ch == '\n') r->state = STATE_HEADER_START;
+                break;
+
+            case STATE_HEADER_START:
+                if (ch == '\r') {
+                    r->state = STATE_HEAD_END;
+                    break;
+                }
+                if (ch == '\n') {
+                    http_head_end(r);
+                    break;
+                }
+                r->state     = STATE_HEADER_NAME;
+                r->nname     = 0;
+                r->nvalue    = 0;
+                r->truncated = false;
+                r->header    = HEADER_OTHER;
+                // Fall through
+
+            case STATE_HEADER_NAME:
+                if (ch == ':') {
+                    r->name[r->nname] = '\0';
+                    for (size_t h = 0; h < NHEADERS; h++) {
+                        if (strcasecmp(r->name, Headers[h].name) == 0) r->header = Headers[h].id;
+                    }
+                    r->state = STATE_HEADER_VALUE;
+                } else if (ch == '\n') {
+                    r->state = STATE_HEADER_START;      // Line without colon is ignored
+                } else if (r->nname + 1 < HTTP_NAME_MAX) {
+                    r->name[r->nname++] = ch;
+                } else {
+                    r->name[0] = '\0';                  // Too long to be of interest
+                }
+                break;
+
+            case STATE_HEADER_VALUE:
+                if (ch == '\n') {
+                    if (r->header != HEADER_OTHER && !http_header(r)) goto error;
+                    r->state = STATE_HEADER_START;
+                } else if (r->header == HEADER_OTHER || ch == '\r' || ((ch == ' ' || ch == '\t') && r->nvalue == 0)) {
+                    // Skip value of uninteresting header and leading whitespace
+                } else if (r->nvalue + 1 < HTTP_VALUE_MAX) {
+                    r->value[r->nvalue++] = ch;
+                } else {
+                    r->truncated = true;
+                }
+                break;
+
+            case STATE_HEAD_END:
+                if (ch != '\n') goto error;
+                http_head_end(r);
+                break;
+
+            default:
+                goto error;
+        }
+    }
+    return i;
+
+error:
+    r->state = STATE_ERROR;
+    return -1;
+}
+
+/**
+ * Consume bytes of the response body, removing any chunked framing.
+ *
+ * At most one contiguous run of payload is reported per call; callers loop
+ * until all bytes are consumed.  The payload points into data, so nothing is
+ * copied.
+ * @param   r           Response parser
+ * @param   data        Bytes received
+ * @param   size        Number of bytes received
+ * @param   payload     Set to offset of payload within data
+ * @param   npayload    Set to number of payload bytes (0 if none)
+ * @return  Number of bytes consumed, or -1 if the response is malformed
+ **/
+ssize_t http_parse_body(Response *r, const char *data, size_t size, size_t *payload, size_t *npayload) {
+    *payload  = 0;
+    *npayload = 0;
+
+    size_t i = 0;
+    while (i < size && !http_done(r)) {
+        char ch = data[i];
+        switch (r->state) {
+            case STATE_BODY_EOF:
+                *payload  = i;
+                *npayload = size - i;
+                return size;
+
+            case STATE_BODY_LENGTH:
+            case STATE_CHUNK_DATA: {
+                uint64_t n = size - i < r->chunk ? size - i : r->chunk;
+                *payload  = i;
+                *npayload = n;
+                http_body_consumed(r, n);
+                return i + n;
+            }
+
+            case STATE_CHUNK_SIZE:
+                if (ch >= '0' && ch <= '9') {
+                    r->chunk = r->chunk * 16 + (ch - '0');
+                } else if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f') {
+                    r->chunk = r->chunk * 16 + ((ch | 0x20) - 'a' + 10);
+                } else if (r->nname > 0 && (ch == ';' || ch == ' ' || ch == '\t' || ch == '\r')) {
+                    r->state = STATE_CHUNK_EXTENSION;
+                    break;
+                } else if (r->nname > 0 && ch == '\n') {
+                    r->state = r->chunk ? STATE_CHUNK_DATA : STATE_TRAILER_START;
+                    break;
+                } else {
+                    goto error;
+                }
+                if (++r->nname > 15) goto error;        // Chunk larger than 2^60
+                break;
+
+            case STATE_CHUNK_EXTENSION:
+                if (ch == '\n') r->state = r->chunk ? STATE_CHUNK_DATA : STATE_TRAILER_START;
+                break;
+
+            case STATE_CHUNK_END:
+                if (ch == '\n') {
+                    r->state = STATE_CHUNK_SIZE;
+                    r->chunk = 0;
+                    r->nname = 0;
+                } else if (ch != '\r') {
+                    goto error;
+                }
+                break;
+
+            case STATE_TRAILER_START:
+                if (ch == '\n') r->state = STATE_DONE;
+                else if (ch != '\r') r->state = STATE_TRAILER;
+                break;
+
+            case STATE_TRAILER:
+                if (ch == '\n') r->state = STATE_TRAILER_START;
+                break;
+
+            default:
+                goto error;
+        }
+        i++;
+    }
+    return i;
+
+error:
+    r->state = STATE_ERROR;
+    return -1;
+}
+
+/**
+ * Return number of payload bytes that may be moved without parsing, so
+ * callers can transfer them directly from the socket.
+ * @param   r           Response parser
+ * @return  Payload bytes left in body or current chunk, UINT64_MAX if the body
+ * runs to end of stream, or 0 if framing must be parsed next
+ **/
+uint64_t http_body_remaining(const Response *r) {
+    switch (r->state) {
+        case STATE_BODY_EOF:    return UINT64_MAX;
+        case STATE_BODY_LENGTH:
+        case STATE_CHUNK_DATA:  return r->chunk;
+        default:                return 0;
+    }
+}
+
+/**
+ * Account for payload bytes moved without parsing.
+ * @param   r           Response parser
+ * @param   n           Number of payload bytes (at most http_body_remaining)
+ **/
+void    http_body_consumed(Response *r, uint64_t n) {
+    if (r->state != STATE_BODY_LENGTH && r->state != STATE_CHUNK_DATA) return;
+
+    r->chunk -= n;
+    if (r->chunk == 0) r->state = r->state == STATE_BODY_LENGTH ? STATE_DONE : STATE_CHUNK_END;
+}
+
+/**
+ * Handle end of stream while reading body.
+ * @param   r           Response parser
+ * @return  true if the body was complete (or delimited by end of stream),
+ * otherwise false
+ **/
+bool    http_body_eof(Response *r) {
+    if (r->state == STATE_BODY_EOF) r->state = STATE_DONE;
+    return r->state == STATE_DONE;
+}
+
+/**
+ * Determine whether the response head has been parsed completely.
+ * @param   r           Response parser
+ * @return  true once the blank line ending the final head was consumed
+ **/
+bool    http_head_done(const Response *r) {
+    return r->state >= STATE_BODY_LENGTH && r->state != STATE_ERROR;
+}
+
+/**
+ * Determine whether the whole response has been parsed.
+ * @param   r           Response parser
+ * @return  true once the body (if any) has been consumed
+ **/
+bool    http_done(const Response *r) {
+    return r->state == STATE_DONE;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,536 @@
+/* jobs.c: Run commands under deadlines, one at a time or in parallel */
+
+#define _GNU_SOURCE
+
+#include "timeit.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Constants */
+
+enum {
+    EVENT_EXIT,         // Job process exited (pidfd readable)
+    EVENT_DEADLINE,     // Job deadline or grace period passed (timerfd readable)
+};
+
+#define EVENT_SIGNAL    UINT64_MAX      /* timeit was signalled (signalfd readable) */
+#define EVENT_SAMPLE    (UINT64_MAX-1)  /* Sampling interval passed (timerfd readable) */
+
+/* Structures */
+
+typedef struct {
+    bool            active;     // Whether slot holds a running job
+    char          **argv;       // Command to execute (NULL to run command with shell)
+    char           *command;    // Shell command line (or name of argv command)
+    size_t          number;     // Position of command in input
+    pid_t           pid;        // Process running command (and its process group)
+    int             pidfd;      // Descriptor of process
+    int             timerfd;    // Deadline timer (-1 if no timeout)
+    bool            terminated; // Whether SIGTERM was sent at deadline
+    bool            foreground; // Whether job's process group was given the terminal
+    struct timespec start;      // When process was started
+    Measurement     measurement;
+} Job;
+
+typedef struct {
+    Job            *jobs;       // Job slots
+    int             slots;      // Number of slots
+    int             running;    // Number of active slots
+    int             epfd;       // Epoll descriptor
+    int             sigfd;      // Signal descriptor of forwarded signals
+    sigset_t        saved;      // Signal mask before runner was opened
+    bool            interrupted;// Whether a signal was forwarded to jobs
+    int             samplefd;   // Sampling timer of first job (-1 if not sampled)
+    SampleList     *samples;    // Samples of first job
+    int             run;        // Run number recorded with samples
+} Runner;
+
+/* Terminal Functions */
+
+/**
+ * Make process group the foreground group of the controlling terminal.
+ * SIGTTOU is blocked meanwhile, since a background group asking for the
+ * terminal would otherwise be stopped.
+ * @param   pgid        Process group to give the terminal to.
+ **/
+static void terminal_give(pid_t pgid) {
+    sigset_t mask, saved;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &mask, &saved);
+    if (tcsetpgrp(STDIN_FILENO, pgid) < 0) debug("Unable to tcsetpgrp: %s\n", strerror(errno));
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+}
+
+/* Runner Functions */
+
+/**
+ * Prepare runner with slots for jobs.  Termination signals are blocked and
+ * read through a signalfd, so they can be forwarded to each job's process
+ * group instead of leaving the groups running.
+ * @param   runner      Runner to open.
+ * @param   slots       Maximum number of jobs running at once.
+ * @return  Whether or not the runner was opened.
+ **/
+static bool runner_open(Runner *runner, int slots) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGQUIT);
+
+    *runner = (Runner){.slots = slots, .epfd = -1, .sigfd = -1, .samplefd = -1};
+    sigprocmask(SIG_BLOCK, &mask, &runner->saved);
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EVENT_SIGNAL};
+    if ((runner->jobs  = calloc(slots, sizeof(Job))) == NULL ||
+        (runner->epfd  = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (runner->sigfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK)) < 0 ||
+        epoll_ctl(runner->epfd, EPOLL_CTL_ADD, runner->sigfd, &ev) < 0) {
+        fprintf(stderr, "Unable to create job table: %s\n", strerror(errno));
+        free(runner->jobs);
+        if (runner->epfd >= 0) close(runner->epfd);
+        if (runner->sigfd >= 0) close(runner->sigfd);
+        sigprocmask(SIG_SETMASK, &runner->saved, NULL);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Release runner and restore signal mask.
+ * @param   runner      Runner without active jobs.
+ **/
+static void runner_close(Runner *runner) {
+    if (runner->samplefd >= 0) close(runner->samplefd);
+    close(runner->sigfd);
+    close(runner->epfd);
+    free(runner->jobs);
+    sigprocmask(SIG_SETMASK, &runner->saved, NULL);
+}
+
+/* Job Functions */
+
+/**
+ * Read next command from input, skipping blank lines and comments.
+ * @param   input       Stream of commands, one per line.
+ * @param   number      Line number, updated as lines are read.
+ * @return  Newly allocated command (must be freed), or NULL at end of input.
+ **/
+static char *job_read(FILE *input, size_t *number) {
+    char   *line = NULL;
+    size_t  size = 0;
+
+    while (getline(&line, &size, input) >= 0) {
+        (*number)++;
+        line[strcspn(line, "\n")] = 0;
+
+        char *start = line + strspn(line, " \t");
+        if (*start && *start != '#') return line;
+    }
+
+    free(line);
+    return NULL;
+}
+
+/**
+ * Register descriptor of job with epoll.
+ * @param   epfd        Epoll descriptor.
+ * @param   fd          Descriptor to watch for input.
+ * @param   slot        Index of job.
+ * @param   event       EVENT_* value reported with it.
+ * @return  Whether or not the descriptor was registered.
+ **/
+static bool job_watch(int epfd, int fd, size_t slot, int event) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = slot << 1 | event};
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+/**
+ * Arm timer of job to expire after seconds.
+ * @param   job         Job with timer.
+ * @param   seconds     Delay (greater than zero).
+ * @return  Whether or not the timer was armed.
+ **/
+static bool job_arm(Job *job, double seconds) {
+    struct itimerspec when = {.it_value = {(time_t)seconds, (long)((seconds - (time_t)seconds) * BILLION)}};
+    if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0) when.it_value.tv_nsec = 1;
+    return timerfd_settime(job->timerfd, 0, &when, NULL) == 0;
+}
+
+/**
+ * Start job in its own process group and arm its deadline.
+ * @param   runner      Runner.
+ * @param   slot        Index of job with argv or command set.
+ * @return  Whether or not the job was started.
+ **/
+static bool job_start(Runner *runner, size_t slot) {
+    Job *job = &runner->jobs[slot];
+
+    job->active      = true;
+    job->pid         = 0;
+    job->pidfd       = -1;
+    job->timerfd     = -1;
+    job->terminated  = false;
+    job->measurement = (Measurement){0};
+
+    // A command reading the terminal from a background group would be
+    // stopped, so a single command takes the terminal over from timeit
+    job->foreground  = job->argv && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+    // Child waits on pipe until counters are attached
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) < 0) {
+        fprintf(stderr, "Unable to pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    fflush(stdout);
+    job->pid = fork();
+
+    if (job->pid < 0) {
+        fprintf(stderr, "Unable to fork: %s\n", strerror(errno));
+        close(ready[0]);
+        close(ready[1]);
+        return false;
+    }
+
+    if (job->pid == 0) {
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, &runner->saved, NULL);
+
+        // Commands may come from standard input, so jobs must not read it
+        if (job->argv == NULL) {
+            int null = open("/dev/null", O_RDONLY);
+            if (null >= 0) dup2(null, STDIN_FILENO);
+        }
+
+        char byte;
+        close(ready[1]);
+        while (read(ready[0], &byte, 1) < 0 && errno == EINTR);
+
+        if (job->argv) {
+            execvp(job->argv[0], job->argv);
+        } else {
+            execl("/bin/sh", "sh", "-c", job->command, NULL);
+        }
+        fprintf(stderr, "Unable to exec: %s\n", strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+
+    // Set group from both sides, so it exists before anything signals it
+    setpgid(job->pid, job->pid);
+    if (job->foreground) terminal_give(job->pid);
+    runner->running++;
+
+    close(ready[0]);
+    if (Counting) job->measurement.counted = counters_open(&job->measurement.counters, job->pid);
+    close(ready[1]);
+
+    debug("Started job %zu as %d: %s\n", job->number, job->pid, job->command);
+
+    job->pidfd = pidfd_open(job->pid, 0);
+    if (job->pidfd < 0 || !job_watch(runner->epfd, job->pidfd, slot, EVENT_EXIT)) {
+        fprintf(stderr, "Unable to watch job %zu: %s\n", job->number, strerror(errno));
+        return false;
+    }
+
+    if (Timeout > 0) {
+        job->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (job->timerfd < 0 || !job_arm(job, Timeout) || !job_watch(runner->epfd, job->timerfd, slot, EVENT_DEADLINE)) {
+            fprintf(stderr, "Unable to arm deadline of job %zu: %s\n", job->number, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Escalate job past its deadline: SIGTERM to its process group first, then
+ * SIGKILL once the grace period passes as well.
+ * @param   job         Job whose timer expired.
+ **/
+static void job_expire(Job *job) {
+    uint64_t expirations;
+    if (read(job->timerfd, &expirations, sizeof(expirations)) < 0) return;
+
+    if (!job->terminated && Grace > 0) {
+        debug("Terminating job %zu (%d)...\n", job->number, job->pid);
+        kill(-job->pid, SIGTERM);
+        job->terminated = true;
+        if (!job_arm(job, Grace)) kill(-job->pid, SIGKILL);
+    } else {
+        debug("Killing job %zu (%d)...\n", job->number, job->pid);
+        kill(-job->pid, SIGKILL);
+    }
+    job->measurement.expired = true;
+}
+
+/**
+ * Reap job whose process exited and release its descriptors.
+ * @param   runner      Runner.
+ * @param   job         Active job.
+ **/
+static void job_finish(Runner *runner, Job *job) {
+    Measurement *m = &job->measurement;
+    struct timespec end;
+
+    // Kill stragglers of expired job while the zombie still holds the group
+    if (m->expired) kill(-job->pid, SIGKILL);
+
+    while (wait4(job->pid, &m->status, 0, &m->usage) < 0 && errno == EINTR);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    m->elapsed     = (end.tv_sec - job->start.tv_sec) + (end.tv_nsec - job->start.tv_nsec) / BILLION;
+
+    // Keyboard signals reached only the job while it held the terminal
+    bool keyboard  = WIFSIGNALED(m->status) && (WTERMSIG(m->status) == SIGINT || WTERMSIG(m->status) == SIGQUIT);
+    m->interrupted = runner->interrupted || (job->foreground && keyboard);
+    if (job->foreground) terminal_give(getpgrp());
+    if (m->counted) counters_collect(&m->counters);
+
+    // Closing descriptors removes them from epoll
+    if (job->pidfd >= 0) close(job->pidfd);
+    if (job->timerfd >= 0) close(job->timerfd);
+
+    job->active = false;
+    runner->running--;
+}
+
+/**
+ * Abandon job that could not be started or watched, killing its process
+ * group if it was forked.
+ * @param   runner      Runner.
+ * @param   job         Active job.
+ **/
+static void job_abort(Runner *runner, Job *job) {
+    if (job->pid > 0) {
+        job->measurement.expired = true;
+        job_finish(runner, job);
+    }
+    job->active = false;
+}
+
+/**
+ * Record sample of job's process group.
+ * @param   runner      Runner with sampling timer.
+ * @param   job         Job sampled.
+ **/
+static void job_sample(Runner *runner, Job *job) {
+    uint64_t expirations;
+    if (read(runner->samplefd, &expirations, sizeof(expirations)) < 0 || !job->active) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    Sample sample = {.run = runner->run};
+    sample.time = (now.tv_sec - job->start.tv_sec) + (now.tv_nsec - job->start.tv_nsec) / BILLION;
+    if (sample_group(job->pid, &sample) && sample.processes > 0) samples_append(runner->samples, &sample);
+}
+
+/**
+ * Wait for events and handle deadlines and signals until some jobs finish.
+ * @param   runner      Runner with active jobs.
+ * @param   finished    Array of JOBS_EVENTS slots to fill with finished jobs.
+ * @return  Number of finished jobs, or -1 on error.
+ **/
+static int  runner_wait(Runner *runner, Job **finished) {
+    struct epoll_event events[JOBS_EVENTS];
+    int nfinished = 0;
+
+    while (nfinished == 0) {
+        int n = epoll_wait(runner->epfd, events, JOBS_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fprintf(stderr, "Unable to epoll_wait: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == EVENT_SIGNAL) {
+                struct signalfd_siginfo info;
+                while (read(runner->sigfd, &info, sizeof(info)) == sizeof(info)) {
+                    debug("Forwarding signal %u to jobs...\n", info.ssi_signo);
+                    for (int slot = 0; slot < runner->slots; slot++) {
+                        if (runner->jobs[slot].active) kill(-runner->jobs[slot].pid, info.ssi_signo);
+                    }
+                    runner->interrupted = true;
+                }
+                continue;
+            }
+
+            if (events[i].data.u64 == EVENT_SAMPLE) {
+                job_sample(runner, &runner->jobs[0]);
+                continue;
+            }
+
+            Job *job = &runner->jobs[events[i].data.u64 >> 1];
+            if (!job->active) continue;     // Finished earlier in this round
+
+            if ((events[i].data.u64 & 1) == EVENT_DEADLINE) {
+                job_expire(job);
+            } else {
+                job_finish(runner, job);
+                finished[nfinished++] = job;
+            }
+        }
+    }
+    return nfinished;
+}
+
+/**
+ * Run command once under the deadline and measure it, sampling its process
+ * group every Interval seconds.
+ * @param   argv        Array of strings representing command to execute.
+ * @param   measurement Measurement to fill in.
+ * @param   samples     List to append samples to (NULL to not sample).
+ * @param   run         Run number recorded with samples.
+ * @return  Whether or not the command was started and waited for.
+ **/
+bool    job_run(char **argv, Measurement *measurement, SampleList *samples, int run) {
+    Runner runner;
+    if (!runner_open(&runner, 1)) return false;
+
+    Job *job = &runner.jobs[0], *finished[JOBS_EVENTS];
+    job->argv    = argv;
+    job->command = argv[0];
+    job->number  = 1;
+
+    bool success = job_start(&runner, 0);
+    if (success && samples && Interval > 0) {
+        struct timespec   period = {(time_t)Interval, (long)((Interval - (time_t)Interval) * BILLION)};
+        struct itimerspec when   = {.it_interval = period, .it_value = period};
+        struct epoll_event ev    = {.events = EPOLLIN, .data.u64 = EVENT_SAMPLE};
+
+        runner.samples  = samples;
+        runner.run      = run;
+        runner.samplefd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (runner.samplefd < 0 || timerfd_settime(runner.samplefd, 0, &when, NULL) < 0 || epoll_ctl(runner.epfd, EPOLL_CTL_ADD, runner.samplefd, &ev) < 0) {
+            fprintf(stderr, "Unable to arm sampling timer: %s\n", strerror(errno));
+            success = false;
+        }
+    }
+    while (success && runner.running) success = runner_wait(&runner, finished) >= 0;
+    if (!success && job->active) job_abort(&runner, job);
+
+    *measurement = job->measurement;
+    runner_close(&runner);
+    return success;
+}
+
+/**
+ * Report how job ended.
+ * @param   job         Finished job.
+ * @return  Whether or not the job succeeded.
+ **/
+static bool job_report(const Job *job) {
+    const Measurement *m = &job->measurement;
+
+    char outcome[32];
+    if (m->expired) {
+        snprintf(outcome, sizeof(outcome), "timed out");
+    } else if (WIFEXITED(m->status)) {
+        snprintf(outcome, sizeof(outcome), "exited %d", WEXITSTATUS(m->status));
+    } else {
+        snprintf(outcome, sizeof(outcome), "killed by signal %d", WTERMSIG(m->status));
+    }
+
+    char clock[48] = "";
+    if (m->counted && m->counters.valid[COUNTER_TASK_CLOCK]) {
+        snprintf(clock, sizeof(clock), ", %0.3lf ms task clock", m->counters.values[COUNTER_TASK_CLOCK] / 1000000.0);
+    }
+
+    const struct rusage *usage = &m->usage;
+    printf("%zu: %s in %0.3lf seconds (%0.3lf user, %0.3lf system, %ld KB%s): %s\n",
+        job->number, outcome, m->elapsed,
+        usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1000000.0,
+        usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1000000.0,
+        usage->ru_maxrss, clock, job->command);
+    fflush(stdout);
+
+    return !m->expired && WIFEXITED(m->status) && WEXITSTATUS(m->status) == EXIT_SUCCESS;
+}
+
+/**
+ * Run every command read from input with at most parallel of them at once.
+ *
+ * Each job is watched through a pidfd, and its deadline through a timerfd,
+ * in a single epoll loop, so deadlines are independent of each other.
+ * @param   input       Stream of shell commands, one per line.
+ * @param   parallel    Maximum number of jobs running at once.
+ * @return  Whether or not every job succeeded.
+ **/
+bool    jobs_run(FILE *input, int parallel) {
+    Runner runner;
+    if (!runner_open(&runner, parallel)) return false;
+
+    Job    *finished[JOBS_EVENTS];
+    struct timespec start, end;
+    size_t  number = 0, started = 0, failed = 0, expired = 0;
+    bool    eof = false, error = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!error) {
+        // Fill free slots with next commands, unless interrupted
+        for (int slot = 0; !eof && !runner.interrupted && runner.running < parallel && slot < parallel; slot++) {
+            Job *job = &runner.jobs[slot];
+            if (job->active) continue;
+
+            free(job->command);
+            if ((job->command = job_read(input, &number)) == NULL) {
+                eof = true;
+                break;
+            }
+
+            job->number = number;
+            started++;
+            if (!job_start(&runner, slot)) {
+                job_abort(&runner, job);
+                error = true;
+                break;
+            }
+        }
+        if (runner.running == 0 || error) break;
+
+        int n = runner_wait(&runner, finished);
+        if (n < 0) error = true;
+        for (int i = 0; i < n; i++) {
+            if (finished[i]->measurement.expired) expired++;
+            if (!job_report(finished[i])) failed++;
+        }
+    }
+
+    // Kill whatever is left after an error
+    for (int slot = 0; slot < parallel; slot++) {
+        Job *job = &runner.jobs[slot];
+        if (job->active) {
+            job_abort(&runner, job);
+            job_report(job);
+            failed++;
+        }
+        free(job->command);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Jobs: %zu (%zu failed, %zu timed out)\n", started, failed, expired);
+    printf("Time Elapsed: %0.3lf\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION);
+
+    bool interrupted = runner.interrupted;
+    runner_close(&runner);
+    return !error && !interrupted && failed == 0;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
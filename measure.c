@@ -0,0 +1,131 @@
+/* measure.c: Resource accounting of commands */
+
+#include "timeit.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* Constants */
+
+static const struct {
+    uint32_t    type;       // Perf event type
+    uint64_t    config;     // Perf event within type
+    const char *name;       // Label in report
+} CounterEvents[NCOUNTERS] = {
+    [COUNTER_TASK_CLOCK]    = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,   "Task Clock"},
+    [COUNTER_CYCLES]        = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,   "Cycles"},
+    [COUNTER_INSTRUCTIONS]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "Instructions"},
+    [COUNTER_CACHE_MISSES]  = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "Cache Misses"},
+};
+
+/* Counter Functions */
+
+/**
+ * Attach perf counters to process before it executes its command.
+ *
+ * Counters start disabled and are enabled by the kernel on exec; they are
+ * inherited by every child the process creates, and the counts of children
+ * are folded in as they exit.  When user and kernel events may not both be
+ * counted, only user events are.
+ * @param   counters    Counters to open.
+ * @param   pid         Process to count (must not have exec'd yet).
+ * @return  Whether or not any counter was opened.
+ **/
+bool    counters_open(Counters *counters, pid_t pid) {
+    bool opened = false;
+    int  error  = 0;
+
+    for (int i = 0; i < NCOUNTERS; i++) {
+        struct perf_event_attr attr = {
+            .type           = CounterEvents[i].type,
+            .size           = sizeof(attr),
+            .config         = CounterEvents[i].config,
+            .read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+            .disabled       = 1,
+            .inherit        = 1,
+            .enable_on_exec = 1,
+        };
+
+        int fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+        if (fd < 0) {
+            debug("Unable to count %s: %s\n", CounterEvents[i].name, strerror(errno));
+            error = errno;
+        }
+
+        counters->fds[i]   = fd;
+        counters->valid[i] = false;
+        opened = opened || fd >= 0;
+    }
+
+    if (!opened) fprintf(stderr, "Unable to perf_event_open: %s\n", strerror(error));
+    return opened;
+}
+
+/**
+ * Read final counts and close counters.
+ * @param   counters    Counters of process that has been waited for.
+ **/
+void    counters_collect(Counters *counters) {
+    for (int i = 0; i < NCOUNTERS; i++) {
+        if (counters->fds[i] < 0) continue;
+
+        // Value, time enabled, time running
+        uint64_t data[3];
+        if (read(counters->fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+            counters->values[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+            counters->valid[i]  = true;
+        }
+
+        close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+}
+
+/* Report Functions */
+
+/**
+ * Print wall clock time, resource usage, and counters of command.
+ * @param   stream      Stream to print to.
+ * @param   measurement Measurement of command.
+ **/
+void    measurement_print(FILE *stream, const Measurement *measurement) {
+    const struct rusage *usage = &measurement->usage;
+
+    fprintf(stream, "Time Elapsed:     %0.3lf\n", measurement->elapsed);
+    if (measurement->expired) {
+        fprintf(stream, "Timed Out:        after %g seconds\n", Timeout);
+    }
+    fprintf(stream, "User Time:        %0.3lf\n", usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1000000.0);
+    fprintf(stream, "System Time:      %0.3lf\n", usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1000000.0);
+    fprintf(stream, "Max RSS:          %ld KB\n", usage->ru_maxrss);
+    fprintf(stream, "Page Faults:      %ld major, %ld minor\n", usage->ru_majflt, usage->ru_minflt);
+    fprintf(stream, "Context Switches: %ld voluntary, %ld involuntary\n", usage->ru_nvcsw, usage->ru_nivcsw);
+
+    if (!measurement->counted) return;
+
+    const Counters *counters = &measurement->counters;
+    for (int i = 0; i < NCOUNTERS; i++) {
+        fprintf(stream, "%s:%*s", CounterEvents[i].name, (int)(17 - strlen(CounterEvents[i].name)), "");
+        if (!counters->valid[i]) {
+            fprintf(stream, "<not supported>\n");
+        } else if (i == COUNTER_TASK_CLOCK) {
+            fprintf(stream, "%0.3lf ms\n", counters->values[i] / 1000000.0);
+        } else if (i == COUNTER_INSTRUCTIONS && counters->valid[COUNTER_CYCLES] && counters->values[COUNTER_CYCLES]) {
+            fprintf(stream, "%lu (%0.2lf per cycle)\n", counters->values[i], (double)counters->values[i] / counters->values[COUNTER_CYCLES]);
+        } else {
+            fprintf(stream, "%lu\n", counters->values[i]);
+        }
+    }
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
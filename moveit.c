@@ -1,20 +1,14 @@
-/* moveit.c: Interactive Move Command */
+/* moveit.c: Interactive and batch move command */
+
+#include "moveit.h"
 
 #include <errno.h>
-#include <stdbool.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <fcntl.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-/* Macros */
-
-#define streq(a, b) (strcmp(a, b) == 0)
-#define strchomp(s) (s)[strlen(s) - 1] = 0
-
 /* Functions */
 
 /**
@@ -22,7 +16,18 @@
  * @param   status      Exit status.
  **/
 void    usage(int status) {
-    fprintf(stderr, "Usage: moveit files...\n");
+    fprintf(stderr, "Usage: moveit [-j JOURNAL] [-t THREADS] files...\n");
+    fprintf(stderr, "       moveit [-j JOURNAL] [-t THREADS] [-0] [-i FILE] -b\n");
+    fprintf(stderr, "       moveit [-j JOURNAL] [-t THREADS] [-0] [-i FILE] -e s/REGEX/REPLACEMENT/[g]\n");
+    fprintf(stderr, "       moveit -u JOURNAL\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -b          Read old and new name pairs and rename without $EDITOR\n");
+    fprintf(stderr, "    -e EXPR     Read old names and rename each by substitution EXPR\n");
+    fprintf(stderr, "    -i FILE     Read names from FILE instead of standard input\n");
+    fprintf(stderr, "    -0          Names are NUL-delimited instead of newline-delimited\n");
+    fprintf(stderr, "    -j JOURNAL  Record renames in JOURNAL as they are performed\n");
+    fprintf(stderr, "    -u JOURNAL  Undo renames recorded in JOURNAL\n");
+    fprintf(stderr, "    -t THREADS  Number of renaming threads (default is number of CPUs)\n");
     exit(status);
 }
 
@@ -99,9 +104,11 @@ bool    edit_files(const char *path) {
  * @param   files       Array of old path names.
  * @param   n           Number of old path names.
  * @param   path        Path to file with new names.
+ * @param   journal     Path of journal to record renames in (NULL for none).
+ * @param   threads     Number of renaming threads.
  * @return  Whether or not all rename operations were successful.
  **/
-bool    move_files(char **files, size_t n, const char *path) {
+bool    move_files(char **files, size_t n, const char *path, const char *journal, int threads) {
     // Open temporary file at path for reading
     FILE *fp = fopen(path, "r");
     
@@ -110,28 +117,46 @@ bool    move_files(char **files, size_t n, const char *path) {
         return false;
     }
 
-    // Rename each file in array according to new name in temporary file
-    // (if the names do not match)
-    char token[BUFSIZ];
-    size_t i = 0;
-
-    while(fgets(token, BUFSIZ, fp) != NULL) {
-        strchomp(token);
-        if (!streq(files[i],token)) {
-            int rst = rename(files[i],token);
-            if (rst < 0) {
-                fprintf(stderr, "Unable to rename file: %s\n", strerror(errno));
-                fclose(fp);
-                return false;
-            }
-        }
-        i++;
-        if (i == n) break;
-    }
+    // Pair each file in array with new name in temporary file
+    RenameList list = {NULL, 0, 0};
+    bool       success = true;
+    char      *token;
+    size_t     i = 0;
 
+    while (success && i < n && (token = read_name(fp, '\n')) != NULL) {
+        char *source = strdup(files[i++]);
+        success = source && renames_append(&list, source, token);
+    }
     fclose(fp);
 
-    return true;
+    success = success && plan_run(&list, journal, threads);
+    renames_delete(&list);
+    return success;
+}
+
+/**
+ * Rename files listed on input stream without running $EDITOR.
+ * @param   input       Path of input file (NULL for standard input).
+ * @param   delimiter   Character ending each name.
+ * @param   sub         Compiled substitution (NULL if input holds pairs).
+ * @param   journal     Path of journal to record renames in (NULL for none).
+ * @param   threads     Number of renaming threads.
+ * @return  Whether or not all names were read and renamed.
+ **/
+bool    batch_files(const char *input, int delimiter, const Substitution *sub, const char *journal, int threads) {
+    FILE *fp = input ? fopen(input, "r") : stdin;
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", input, strerror(errno));
+        return false;
+    }
+
+    RenameList list = {NULL, 0, 0};
+    bool success = sub ? read_names(fp, delimiter, sub, &list) : read_pairs(fp, delimiter, &list);
+    if (input) fclose(fp);
+
+    success = success && plan_run(&list, journal, threads);
+    renames_delete(&list);
+    return success;
 }
 
 /* Main Execution */
@@ -140,13 +165,60 @@ int     main(int argc, char *argv[]) {
     // Parse command line options
     if (argc == 1) usage(1);
 
-    if (streq(argv[1], "-h")) usage(0);
+    bool    batch     = false;
+    char   *expr      = NULL;
+    char   *input     = NULL;
+    char   *journal   = NULL;
+    char   *undo      = NULL;
+    int     delimiter = '\n';
+    int     threads   = sysconf(_SC_NPROCESSORS_ONLN);
+    int     argind    = 1;
+
+    while (argind < argc && argv[argind][0] == '-' && argv[argind][1]) {
+        char *arg = argv[argind++];
+        if (streq(arg, "-h")) usage(0);
+        else if (streq(arg, "-b")) batch = true;
+        else if (streq(arg, "-0")) delimiter = '\0';
+        else if (streq(arg, "-e") && argind < argc) expr  = argv[argind++];
+        else if (streq(arg, "-i") && argind < argc) input = argv[argind++];
+        else if (streq(arg, "-j") && argind < argc) journal = argv[argind++];
+        else if (streq(arg, "-u") && argind < argc) undo    = argv[argind++];
+        else if (streq(arg, "-t") && argind < argc) threads = atoi(argv[argind++]);
+        else usage(1);
+    }
+
+    if (threads < 1) threads = 1;
+
+    // Undo renames recorded in journal
+    if (undo) {
+        if (argind != argc || batch || expr || journal) usage(1);
+        return journal_undo(undo) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Batch mode: names come from input instead of arguments and $EDITOR
+    if (batch || expr) {
+        if (argind != argc || (batch && expr)) usage(1);
+
+        Substitution sub;
+        if (expr && !substitution_compile(expr, &sub)) {
+            fprintf(stderr, "Invalid substitution: %s\n", expr);
+            return EXIT_FAILURE;
+        }
+
+        bool success = batch_files(input, delimiter, expr ? &sub : NULL, journal, threads);
+        if (expr) {
+            regfree(&sub.regex);
+            free(sub.replacement);
+        }
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argind == argc || input || delimiter != '\n') usage(1);
 
-    char *path = save_files(&argv[1], argc-1);
+    char *path = save_files(&argv[argind], argc-argind);
 
     if (!edit_files(path)) usage(1);
 
-    if (!move_files(&argv[1], argc-1, path)) usage(1);
+    if (!move_files(&argv[argind], argc-argind, path, journal, threads)) usage(1);
 
     // Cleanup temporary file
     int cstatus = unlink(path);
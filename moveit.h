@@ -0,0 +1,102 @@
+/* moveit.h: Interactive and batch move command */
+
+#pragma once
+
+#include <pthread.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Constants */
+
+#define EXECUTE_BATCH   1024        /* Operations a worker claims at once */
+#define DIRCACHE_SIZE   8           /* Directory descriptors cached per worker */
+#define COPY_BUFFER     (1<<20)     /* Bytes per read when copying across file systems */
+
+/* Macros */
+
+#define streq(a, b) (strcmp(a, b) == 0)
+
+/* Rename Structures */
+
+typedef struct {
+    char       *source;     // Current path of file
+    char       *target;     // New path of file
+} Rename;
+
+typedef struct {
+    Rename     *data;       // Array of renames in input order
+    size_t      size;       // Number of renames
+    size_t      capacity;   // Capacity of array
+} RenameList;
+
+typedef struct {
+    regex_t     regex;      // Compiled pattern
+    char       *replacement;// Replacement (& and \1 through \9 refer to match)
+    bool        global;     // Whether every match is replaced
+} Substitution;
+
+/* Operation Structures */
+
+enum {
+    OP_RENAME   = 'R',      // Move from to to (to must not exist)
+    OP_EXCHANGE = 'X',      // Swap from and to atomically
+};
+
+typedef struct {
+    int         kind;       // OP_RENAME or OP_EXCHANGE
+    char       *from;       // Path renamed (or first path exchanged)
+    char       *to;         // New path (or second path exchanged)
+} Operation;
+
+typedef struct {
+    Operation  *data;       // Array of operations in execution order
+    size_t      size;       // Number of operations
+    size_t      capacity;   // Capacity of array
+} OperationList;
+
+typedef struct {
+    OperationList   operations; // Operations in execution order (paths point into renames)
+    size_t         *sequences;  // Index of first operation of each independent sequence
+    size_t          nsequences; // Number of sequences
+    bool            nested;     // Whether some path lies inside a renamed directory
+    char          **rewritten;  // Targets rewritten by operation (owned, NULL if kept)
+} Plan;
+
+typedef struct {
+    OperationList   applied;    // Operations performed so far (paths owned)
+    FILE           *fp;         // Journal file (NULL if kept in memory only)
+    pthread_mutex_t lock;       // Serializes recording by workers
+} Journal;
+
+/* Name Functions */
+
+bool    renames_append(RenameList *list, char *source, char *target);
+void    renames_delete(RenameList *list);
+char *  read_name(FILE *fp, int delimiter);
+bool    read_pairs(FILE *fp, int delimiter, RenameList *list);
+bool    read_names(FILE *fp, int delimiter, const Substitution *sub, RenameList *list);
+bool    substitution_compile(const char *expr, Substitution *sub);
+char *  substitution_apply(const Substitution *sub, const char *name);
+
+/* Plan Functions */
+
+bool    plan_build(const RenameList *list, Plan *plan);
+void    plan_delete(Plan *plan);
+bool    plan_run(const RenameList *list, const char *journal, int threads);
+
+/* Execute Functions */
+
+int     move_noreplace(int fromfd, const char *from, int tofd, const char *to);
+bool    move_exchange(Journal *journal, const char *a, const char *b);
+bool    plan_execute(const Plan *plan, Journal *journal, int threads);
+
+/* Journal Functions */
+
+bool    journal_open(Journal *journal, const char *path);
+bool    journal_record(Journal *journal, int kind, const char *from, const char *to);
+void    journal_close(Journal *journal);
+bool    journal_rollback(Journal *journal);
+bool    journal_undo(const char *path);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
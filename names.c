@@ -0,0 +1,233 @@
+/* names.c: Rename lists from name pairs and substitutions */
+
+#include "moveit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Functions */
+
+/**
+ * Drop trailing slashes from path, keeping a lone root.
+ * @param   path        Path to trim in place.
+ **/
+static void path_trim(char *path) {
+    for (size_t n = strlen(path); n > 1 && path[n - 1] == '/'; n--) path[n - 1] = 0;
+}
+
+/**
+ * Append rename to list, taking ownership of both paths.
+ *
+ * Trailing slashes (as left by shell completion of directories) are dropped,
+ * so that every path names its file by the final component.
+ * @param   list        Pointer to rename list.
+ * @param   source      Current path of file.
+ * @param   target      New path of file.
+ * @return  Whether or not the rename was appended.
+ **/
+bool    renames_append(RenameList *list, char *source, char *target) {
+    if (list->size == list->capacity) {
+        size_t  capacity = list->capacity ? 2 * list->capacity : 1024;
+        Rename *data     = realloc(list->data, capacity * sizeof(Rename));
+        if (data == NULL) {
+            fprintf(stderr, "Unable to realloc: %s\n", strerror(errno));
+            free(source);
+            free(target);
+            return false;
+        }
+        list->data     = data;
+        list->capacity = capacity;
+    }
+
+    path_trim(source);
+    path_trim(target);
+    list->data[list->size++] = (Rename){source, target};
+    return true;
+}
+
+/**
+ * Release every path in rename list and the list itself.
+ * @param   list        Pointer to rename list.
+ **/
+void    renames_delete(RenameList *list) {
+    for (size_t i = 0; i < list->size; i++) {
+        free(list->data[i].source);
+        free(list->data[i].target);
+    }
+    free(list->data);
+}
+
+/**
+ * Read next name from stream.
+ * @param   fp          Stream to read from.
+ * @param   delimiter   Character ending each name ('\n' or '\0').
+ * @return  Newly allocated name (must be freed), or NULL at end of stream.
+ **/
+char *  read_name(FILE *fp, int delimiter) {
+    char   *name = NULL;
+    size_t  size = 0;
+    ssize_t n    = getdelim(&name, &size, delimiter, fp);
+
+    if (n < 0) {
+        free(name);
+        return NULL;
+    }
+    if (n > 0 && name[n - 1] == delimiter) name[n - 1] = 0;
+    return name;
+}
+
+/**
+ * Read (old, new) name pairs from stream.
+ * @param   fp          Stream to read from.
+ * @param   delimiter   Character ending each name.
+ * @param   list        Rename list to append to.
+ * @return  Whether or not every name was paired.
+ **/
+bool    read_pairs(FILE *fp, int delimiter, RenameList *list) {
+    char *source;
+    while ((source = read_name(fp, delimiter)) != NULL) {
+        char *target = read_name(fp, delimiter);
+        if (target == NULL) {
+            fprintf(stderr, "Unable to read new name of %s\n", source);
+            free(source);
+            return false;
+        }
+        if (!renames_append(list, source, target)) return false;
+    }
+    return true;
+}
+
+/**
+ * Compile substitution expression of the form s/REGEX/REPLACEMENT/[g], where
+ * any character may take the place of /.
+ * @param   expr        Substitution expression.
+ * @param   sub         Substitution to initialize.
+ * @return  Whether or not the expression was valid.
+ **/
+bool    substitution_compile(const char *expr, Substitution *sub) {
+    if (expr[0] != 's' || expr[1] == 0) return false;
+
+    char  delimiter = expr[1];
+    char *pattern   = strdup(expr + 2);
+    if (pattern == NULL) return false;
+
+    char *replacement = strchr(pattern, delimiter);
+    char *flags       = replacement ? strchr(replacement + 1, delimiter) : NULL;
+    if (flags == NULL || (flags[1] && !streq(flags + 1, "g"))) {
+        free(pattern);
+        return false;
+    }
+    *replacement++ = 0;
+    *flags++       = 0;
+
+    int status = regcomp(&sub->regex, pattern, REG_EXTENDED);
+    if (status != 0) {
+        char message[BUFSIZ];
+        regerror(status, &sub->regex, message, sizeof(message));
+        fprintf(stderr, "Unable to regcomp: %s\n", message);
+        free(pattern);
+        return false;
+    }
+
+    sub->replacement = strdup(replacement);
+    sub->global      = streq(flags, "g");
+    free(pattern);
+    return sub->replacement != NULL;
+}
+
+/**
+ * Apply substitution to name.
+ * @param   sub         Compiled substitution.
+ * @param   name        Name to rewrite.
+ * @return  Newly allocated new name (must be freed), or NULL if the pattern
+ * does not match name.
+ **/
+char *  substitution_apply(const Substitution *sub, const char *name) {
+    regmatch_t  match[10];
+    char       *result = NULL;
+    size_t      size   = 0;
+    FILE       *fp     = open_memstream(&result, &size);
+    if (fp == NULL) return NULL;
+
+    bool        matched  = false;
+    bool        adjacent = false;   // Whether s follows a non-empty match
+    const char *s        = name;
+    int         flags    = 0;
+    while (regexec(&sub->regex, s, 10, match, flags) == 0) {
+        // An empty match right after a match is not replaced again
+        if (adjacent && match[0].rm_eo == 0) {
+            if (*s == 0) break;
+            fputc(*s++, fp);
+            adjacent = false;
+            continue;
+        }
+        matched = true;
+        fwrite(s, 1, match[0].rm_so, fp);
+
+        // Expand & and \N references to the match
+        for (const char *r = sub->replacement; *r; r++) {
+            int group = -1;
+            if (*r == '&') {
+                group = 0;
+            } else if (*r == '\\' && r[1] >= '0' && r[1] <= '9') {
+                group = *++r - '0';
+            } else if (*r == '\\' && r[1]) {
+                r++;
+            }
+
+            if (group < 0) {
+                fputc(*r, fp);
+            } else if (match[group].rm_so >= 0) {
+                fwrite(s + match[group].rm_so, 1, match[group].rm_eo - match[group].rm_so, fp);
+            }
+        }
+
+        // Empty matches still have to make progress
+        if (match[0].rm_eo == match[0].rm_so) {
+            if (s[match[0].rm_eo] == 0) {
+                s += match[0].rm_eo;
+                break;
+            }
+            fputc(s[match[0].rm_eo], fp);
+            s += match[0].rm_eo + 1;
+            adjacent = false;
+        } else {
+            s += match[0].rm_eo;
+            adjacent = true;
+        }
+        flags = REG_NOTBOL;
+        if (!sub->global) break;
+    }
+    fputs(s, fp);
+    fclose(fp);
+
+    if (!matched) {
+        free(result);
+        return NULL;
+    }
+    return result;
+}
+
+/**
+ * Read old names from stream and derive new names by substitution.
+ * @param   fp          Stream to read from.
+ * @param   delimiter   Character ending each name.
+ * @param   sub         Compiled substitution.
+ * @param   list        Rename list to append to.
+ * @return  Whether or not every name was read.
+ **/
+bool    read_names(FILE *fp, int delimiter, const Substitution *sub, RenameList *list) {
+    char *source;
+    while ((source = read_name(fp, delimiter)) != NULL) {
+        char *target = substitution_apply(sub, source);
+        if (target == NULL) {
+            free(source);
+            continue;
+        }
+        if (!renames_append(list, source, target)) return false;
+    }
+    return true;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
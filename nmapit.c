@@ -1,19 +1,20 @@
 /* nmapit.c: Simple network port scanner */
 
-#include "socket.h"
+#include "nmapit.h"
 
-#include <stdbool.h>
-#include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <netdb.h>
-#include <signal.h>
+/* Structures */
 
-#ifndef GNU_SOURCE
-typedef void (*sighandler_t)(int);
-#endif
+typedef struct {
+    bool            single;     // Whether only port numbers are printed
+    bool            banners;    // Whether services and banners are printed
+    bool            found;      // Whether any port was found open
+    pthread_mutex_t lock;       // Serializes updates from workers
+} Results;
 
 /* Functions */
 
@@ -22,21 +23,25 @@ typedef void (*sighandler_t)(int);
  * @param   status      Exit status
  **/
 void    usage(int status) {
-    fprintf(stderr, "Usage: nmapit [-p START-END] HOST\n");
+    fprintf(stderr, "Usage: nmapit [-p START-END] [-T MS] [-a] [-t THREADS] [-c N] [-r RATE] [-s] [-b] [-u] [-i FILE] TARGET...\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "    -p START-END    Specifies the range of port numbers to scan\n");
+    fprintf(stderr, "    -T MS           Connection timeout in milliseconds (default is %d)\n", TIMEOUT_DEFAULT);
+    fprintf(stderr, "    -a              Adapt timeout from observed round-trip times\n");
+    fprintf(stderr, "    -t THREADS      Number of worker threads (default is number of CPUs)\n");
+    fprintf(stderr, "    -c N            Maximum connections in flight (default is %d per thread)\n", INFLIGHT_MAX);
+    fprintf(stderr, "    -r RATE         Maximum connections per second (default is unlimited)\n");
+    fprintf(stderr, "    -s              Scan ports sequentially instead of in random order\n");
+    fprintf(stderr, "    -b              Grab banners and identify services on open ports\n");
+    fprintf(stderr, "    -u              Use io_uring for socket I/O when available\n");
+    fprintf(stderr, "    -i FILE         Read additional targets from FILE (- for stdin)\n");
+    fprintf(stderr, "Targets:\n");
+    fprintf(stderr, "    HOST            Host name or address\n");
+    fprintf(stderr, "    A.B.C.D/N       CIDR block\n");
+    fprintf(stderr, "    A.B.C.D-E       Address range (last octet or full address)\n");
     exit(status);
 }
 
-/**
- * Handle alarm signal.
- * @param   signum      Signal number
- **/
-void sigalrm_handler(int signum) {
-    // Cancel current alarm
-    alarm(0);
-}
-
 /**
  * Parse port range string into start and end port integers.
  * @param   range       Port range string (ie. START-END)
@@ -56,40 +61,31 @@ bool parse_ports(char *range, int *start, int *end) {
     if (token == NULL)
         return false;
     *end = atoi(token);
-    
-    return true;
+
+    return *start > 0 && *end <= PORT_MAX && *start <= *end;
 }
 
 /**
- * Scan ports at specified host from starting and ending port numbers
- * (inclusive).
- * @param   host        Host to scan
- * @param   start       Starting port number
- * @param   end         Ending port number
- * @return  true if any port is found, otherwise false
+ * Print open ports as workers report them.
+ * @param   result      Result of probing port
+ * @param   arg         Pointer to results structure
  **/
-bool scan_ports(const char* host, int start, int end) {
-    // Register signal handler for alarm
-    struct sigaction action = {.sa_handler = sigalrm_handler};
-    sigaction(SIGALRM, &action, NULL);
-
-    // For each port, set alarm, attempt to dial host and port
-    char port_str[BUFSIZ];
-    bool p = false;
-
-    for (int i = start; i <= end; i++) {
-        alarm(1);
-        sprintf(port_str, "%d", i);
-
-        if (socket_dial(host, port_str) != NULL) {
-            alarm(0);
-            printf("%s\n", port_str);
-            p = true;
-        }
+void report_port(const Result *result, void *arg) {
+    Results *results = arg;
+    if (result->state != PORT_OPEN) return;
+
+    pthread_mutex_lock(&results->lock);
+    if (!results->single) printf("%s ", result->host);
+    if (results->banners) {
+        printf("%d %s%s%s\n", result->port,
+            result->service ? result->service : "unknown",
+            result->banner  ? " " : "",
+            result->banner  ? result->banner  : "");
+    } else {
+        printf("%d\n", result->port);
     }
-    
-    if (p) return true;
-    else return false;
+    results->found = true;
+    pthread_mutex_unlock(&results->lock);
 }
 
 /* Main Execution */
@@ -98,27 +94,86 @@ int main(int argc, char *argv[]) {
     // Parse command-line arguments
     if (argc < 2) usage(1);
 
-    char *range = NULL;
-    char *host = NULL;
-    int start = 1;
-    int end = 1023;
+    char  **specs  = calloc(argc, sizeof(char *));
+    size_t  nspecs = 0;
+    FILE   *file   = NULL;
+
+    Results results = {.found = false, .lock = PTHREAD_MUTEX_INITIALIZER};
+    Options options = {
+        .start          = 1,
+        .end            = 1023,
+        .timeout        = TIMEOUT_DEFAULT,
+        .adaptive       = false,
+        .threads        = sysconf(_SC_NPROCESSORS_ONLN),
+        .inflight       = 0,
+        .rate           = 0,
+        .randomize      = true,
+        .banners        = false,
+        .uring          = false,
+        .banner_timeout = BANNER_TIMEOUT,
+        .report         = report_port,
+        .arg            = &results,
+    };
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-h") == 0) usage(0);
         else if (strcmp(argv[i], "-p") == 0) {
             if (i+1 >= argc) usage(1);
-            else {
-                range = argv[i+1];
-                i++;
-                if (!parse_ports(range, &start, &end)) usage(EXIT_FAILURE);
+            if (!parse_ports(argv[++i], &options.start, &options.end)) usage(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "-T") == 0) {
+            if (i+1 >= argc) usage(1);
+            options.timeout = atoi(argv[++i]);
+            if (options.timeout <= 0) usage(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            options.adaptive = true;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            if (i+1 >= argc) usage(1);
+            options.threads = atoi(argv[++i]);
+            if (options.threads <= 0) usage(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            if (i+1 >= argc) usage(1);
+            options.inflight = atoi(argv[++i]);
+            if (options.inflight <= 0) usage(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            if (i+1 >= argc) usage(1);
+            options.rate = atoi(argv[++i]);
+            if (options.rate <= 0) usage(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            options.randomize = false;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            options.banners = results.banners = true;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            options.uring = true;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            if (i+1 >= argc || file) usage(1);
+            i++;
+            file = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+            if (file == NULL) {
+                fprintf(stderr, "Unable to open %s: %s\n", argv[i], strerror(errno));
+                return EXIT_FAILURE;
             }
+        } else if (argv[i][0] == '-') {
+            usage(1);
         } else {
-            host = argv[i];
+            specs[nspecs++] = argv[i];
         }
     }
 
+    if (nspecs == 0 && file == NULL) usage(1);
+    if (options.threads < 1) options.threads = 1;
+
+    // Print bare port numbers when scanning a single host
+    results.single = file == NULL && nspecs == 1 && target_is_single(specs[0]);
+
     // Scan ports
-    if (scan_ports(host, start, end)) return EXIT_SUCCESS;
+    TargetStream targets;
+    target_stream_init(&targets, specs, nspecs, file);
+    bool success = scan_targets(&targets, &options);
+
+    if (file && file != stdin) fclose(file);
+    free(specs);
+
+    if (success && results.found) return EXIT_SUCCESS;
     return EXIT_FAILURE;
 }
 
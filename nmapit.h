@@ -0,0 +1,95 @@
+/* nmapit.h: Simple network port scanner */
+
+#pragma once
+
+#include "socket.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <netdb.h>
+#include <pthread.h>
+
+/* Constants */
+
+#define TIMEOUT_DEFAULT     1000        /* Connection timeout (ms) */
+#define TIMEOUT_MINIMUM     10          /* Lower bound of adaptive timeout (ms) */
+#define INFLIGHT_MAX        256         /* Default concurrent connection attempts per worker */
+#define JOB_PORTS           64          /* Ports handed to a worker at a time */
+#define BANNER_TIMEOUT      1000        /* Time to wait for a banner (ms) */
+#define PORT_MAX            65535
+
+/* Port States */
+
+enum {
+    PORT_OPEN,
+    PORT_CLOSED,
+    PORT_FILTERED,
+};
+
+/* Options Structure */
+
+typedef struct {
+    const char *host;       // Host that was probed
+    int         port;       // Port that was probed
+    int         state;      // Port state (PORT_OPEN, PORT_CLOSED, PORT_FILTERED)
+    uint64_t    rtt;        // Time from connect to result (us)
+    const char *service;    // Service matched from banner (NULL if unknown)
+    const char *banner;     // First line of banner (NULL if none was read)
+} Result;
+
+typedef void (*Report)(const Result *result, void *arg);
+
+typedef struct {
+    int     start;          // Starting port number (-p)
+    int     end;            // Ending port number (-p)
+    int     timeout;        // Connection timeout in milliseconds (-T)
+    bool    adaptive;       // Adapt timeout from round-trip times (-a)
+    int     threads;        // Number of worker threads (-t)
+    int     inflight;       // Maximum connections in flight, 0 for default (-c)
+    int     rate;           // Maximum connections per second, 0 for unlimited (-r)
+    bool    randomize;      // Probe ports in random order (-s disables)
+    bool    banners;        // Grab banners from open ports (-b)
+    bool    uring;          // Use io_uring instead of epoll if available (-u)
+    int     banner_timeout; // Time to wait for banner in milliseconds
+    Report  report;         // Called from workers with each port result
+    void   *arg;            // Argument passed to report
+} Options;
+
+/* Target Structures */
+
+typedef struct {
+    char        name[NI_MAXHOST];   // Host name or address string
+    Address     address;            // Address to probe (port unset)
+} Target;
+
+typedef struct {
+    char      **specs;      // Target specifications (host, CIDR, range)
+    size_t      nspecs;     // Number of target specifications
+    size_t      index;      // Next target specification to expand
+    FILE       *file;       // Stream of additional specifications (-i)
+    uint32_t    next;       // Next IPv4 address of current range
+    uint32_t    last;       // Last IPv4 address of current range
+    bool        ranging;    // Whether a range is being expanded
+} TargetStream;
+
+/* Target Functions */
+
+void    target_stream_init(TargetStream *ts, char **specs, size_t nspecs, FILE *file);
+bool    target_stream_next(TargetStream *ts, Target *target);
+bool    target_is_single(const char *spec);
+
+/* Service Functions */
+
+bool        service_init();
+void        service_free();
+const char *service_match(const char *banner);
+bool        service_probe_first(int port);
+char *      service_first_line(char *banner);
+
+/* Scan Functions */
+
+bool    scan_targets(TargetStream *targets, Options *options);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
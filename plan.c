@@ -0,0 +1,587 @@
+/* plan.c: Rename planning and undo journal */
+
+#define _GNU_SOURCE
+
+#include "moveit.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+/* Structures */
+
+typedef struct {
+    const char *key;        // Path (NULL for empty slot)
+    size_t      value;      // Index of rename
+} Slot;
+
+typedef struct {
+    Slot       *slots;      // Open addressing table
+    size_t      capacity;   // Number of slots (power of two)
+} Index;
+
+typedef struct {
+    size_t      depth;      // Depth of shallowest source in sequence
+    size_t      start;      // First operation of sequence
+    size_t      end;        // Past last operation of sequence
+} Span;
+
+/* Index Functions */
+
+/**
+ * Compute FNV-1a hash of string.
+ * @param   s           String to hash.
+ * @return  Hash of string.
+ **/
+static uint64_t index_hash(const char *s) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Allocate index large enough for n paths.
+ * @param   index       Index to initialize.
+ * @param   n           Number of paths to be inserted.
+ * @return  Whether or not the index was allocated.
+ **/
+static bool index_init(Index *index, size_t n) {
+    index->capacity = 16;
+    while (index->capacity < 2 * n) index->capacity *= 2;
+    index->slots = calloc(index->capacity, sizeof(Slot));
+    if (index->slots == NULL) fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+    return index->slots != NULL;
+}
+
+/**
+ * Find slot of path in index.
+ * @param   index       Index to search.
+ * @param   key         Path to find.
+ * @return  Slot holding path, or empty slot where it belongs.
+ **/
+static Slot *index_slot(const Index *index, const char *key) {
+    size_t i = index_hash(key) & (index->capacity - 1);
+    while (index->slots[i].key && !streq(index->slots[i].key, key)) {
+        i = (i + 1) & (index->capacity - 1);
+    }
+    return &index->slots[i];
+}
+
+/**
+ * Look up rename associated with path.
+ * @param   index       Index to search.
+ * @param   key         Path to find.
+ * @return  Index of rename, or -1 if path is not in index.
+ **/
+static ssize_t index_find(const Index *index, const char *key) {
+    Slot *slot = index_slot(index, key);
+    return slot->key ? (ssize_t)slot->value : -1;
+}
+
+/* Operation Functions */
+
+/**
+ * Append operation to list.
+ * @param   list        Operation list.
+ * @param   kind        OP_RENAME or OP_EXCHANGE.
+ * @param   from        Path renamed (or first path exchanged).
+ * @param   to          New path (or second path exchanged).
+ * @return  Whether or not the operation was appended.
+ **/
+static bool operations_append(OperationList *list, int kind, char *from, char *to) {
+    if (list->size == list->capacity) {
+        size_t     capacity = list->capacity ? 2 * list->capacity : 1024;
+        Operation *data     = realloc(list->data, capacity * sizeof(Operation));
+        if (data == NULL) {
+            fprintf(stderr, "Unable to realloc: %s\n", strerror(errno));
+            return false;
+        }
+        list->data     = data;
+        list->capacity = capacity;
+    }
+
+    list->data[list->size++] = (Operation){kind, from, to};
+    return true;
+}
+
+/* Journal Functions */
+
+/**
+ * Write operation to journal file as NUL-delimited kind, from, and to.
+ * @param   fp          Journal file.
+ * @param   op          Operation to write.
+ * @return  Whether or not the operation reached the file.
+ **/
+static bool journal_write(FILE *fp, const Operation *op) {
+    fprintf(fp, "%c%c%s%c%s%c", op->kind, 0, op->from, 0, op->to, 0);
+    return fflush(fp) == 0;
+}
+
+/**
+ * Record operation that was just performed.
+ * @param   journal     Journal.
+ * @param   kind        OP_RENAME or OP_EXCHANGE.
+ * @param   from        Path renamed (or first path exchanged).
+ * @param   to          New path (or second path exchanged).
+ * @return  Whether or not the operation was recorded.
+ **/
+bool    journal_record(Journal *journal, int kind, const char *from, const char *to) {
+    char *f = strdup(from);
+    char *t = strdup(to);
+    bool  success = f && t;
+
+    pthread_mutex_lock(&journal->lock);
+    success = success && operations_append(&journal->applied, kind, f, t);
+    if (!success) {
+        free(f);
+        free(t);
+    } else if (journal->fp && !journal_write(journal->fp, &journal->applied.data[journal->applied.size - 1])) {
+        fprintf(stderr, "Unable to write journal: %s\n", strerror(errno));
+        success = false;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return success;
+}
+
+/**
+ * Reverse single operation.
+ * @param   op          Operation to reverse.
+ * @return  Whether or not the operation was reversed.
+ **/
+static bool journal_revert(const Operation *op) {
+    int status = op->kind == OP_EXCHANGE ?
+        renameat2(AT_FDCWD, op->from, AT_FDCWD, op->to, RENAME_EXCHANGE) :
+        move_noreplace(AT_FDCWD, op->to, AT_FDCWD, op->from);
+    if (status < 0) {
+        fprintf(stderr, "Unable to undo rename of %s to %s: %s\n", op->from, op->to, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Open journal, recording operations in file at path if given.
+ * @param   journal     Journal to initialize.
+ * @param   path        Path of journal file (NULL to keep it in memory only).
+ * @return  Whether or not the journal was opened.
+ **/
+bool    journal_open(Journal *journal, const char *path) {
+    journal->applied = (OperationList){NULL, 0, 0};
+    journal->fp      = NULL;
+    pthread_mutex_init(&journal->lock, NULL);
+    if (path && (journal->fp = fopen(path, "we")) == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        pthread_mutex_destroy(&journal->lock);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Close journal and release its operations.
+ * @param   journal     Journal to close.
+ **/
+void    journal_close(Journal *journal) {
+    for (size_t i = 0; i < journal->applied.size; i++) {
+        free(journal->applied.data[i].from);
+        free(journal->applied.data[i].to);
+    }
+    free(journal->applied.data);
+    if (journal->fp) fclose(journal->fp);
+    journal->applied = (OperationList){NULL, 0, 0};
+    journal->fp      = NULL;
+    pthread_mutex_destroy(&journal->lock);
+}
+
+/**
+ * Undo every operation in journal, most recent first.
+ *
+ * Rollback stops at the first operation that cannot be undone; the journal
+ * file is rewritten to hold exactly the operations still in effect.
+ * @param   journal     Journal to roll back.
+ * @return  Whether or not every operation was undone.
+ **/
+bool    journal_rollback(Journal *journal) {
+    OperationList *applied = &journal->applied;
+    while (applied->size > 0 && journal_revert(&applied->data[applied->size - 1])) {
+        applied->size--;
+        free(applied->data[applied->size].from);
+        free(applied->data[applied->size].to);
+    }
+
+    if (journal->fp) {
+        rewind(journal->fp);
+        if (ftruncate(fileno(journal->fp), 0) < 0) return false;
+        for (size_t i = 0; i < applied->size; i++) journal_write(journal->fp, &applied->data[i]);
+    }
+    return applied->size == 0;
+}
+
+/**
+ * Undo renames recorded in journal file by a previous run.
+ * @param   path        Path of journal file.
+ * @return  Whether or not every recorded rename was undone.
+ **/
+bool    journal_undo(const char *path) {
+    FILE *fp = fopen(path, "re+");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    Journal journal;
+    char   *kind;
+    bool    success = true;
+    journal_open(&journal, NULL);
+    while (success && (kind = read_name(fp, '\0')) != NULL) {
+        char *from = read_name(fp, '\0');
+        char *to   = read_name(fp, '\0');
+        if (from == NULL || to == NULL || (kind[0] != OP_RENAME && kind[0] != OP_EXCHANGE) || kind[1]) {
+            fprintf(stderr, "Unable to read %s: malformed journal\n", path);
+            free(from);
+            free(to);
+            success = false;
+        } else {
+            success = operations_append(&journal.applied, kind[0], from, to);
+        }
+        free(kind);
+    }
+
+    journal.fp = fp;
+    if (success) success = journal_rollback(&journal);
+    journal_close(&journal);
+    return success;
+}
+
+/* Plan Functions */
+
+/**
+ * Mark start of new independent sequence of operations.
+ * @param   plan        Plan being built.
+ * @return  Whether or not the sequence was recorded.
+ **/
+static bool plan_sequence(Plan *plan) {
+    if ((plan->nsequences & (plan->nsequences - 1)) == 0) {
+        size_t  capacity  = plan->nsequences ? 2 * plan->nsequences : 1;
+        size_t *sequences = realloc(plan->sequences, capacity * sizeof(size_t));
+        if (sequences == NULL) {
+            fprintf(stderr, "Unable to realloc: %s\n", strerror(errno));
+            return false;
+        }
+        plan->sequences = sequences;
+    }
+    plan->sequences[plan->nsequences++] = plan->operations.size;
+    return true;
+}
+
+/**
+ * Determine whether any directory containing path is itself renamed.
+ * @param   path        Path to check.
+ * @param   sources     Index of sources.
+ * @param   targets     Index of targets.
+ * @return  Whether or not path lies inside a source or target.
+ **/
+static bool plan_nested(const char *path, const Index *sources, const Index *targets) {
+    char prefix[BUFSIZ];
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t length = slash - path;
+        if (length == 0 || length >= sizeof(prefix)) continue;
+        memcpy(prefix, path, length);
+        prefix[length] = 0;
+        if (index_find(sources, prefix) >= 0 || index_find(targets, prefix) >= 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Count directories above path.
+ * @param   path        Path to measure.
+ * @return  Number of slashes in path.
+ **/
+static size_t plan_depth(const char *path) {
+    size_t depth = 0;
+    for (; *path; path++) depth += *path == '/';
+    return depth;
+}
+
+/**
+ * Order spans deepest first, keeping planned order among equal depths.
+ * @param   a           First span.
+ * @param   b           Second span.
+ * @return  Negative, zero, or positive as a sorts before, with, or after b.
+ **/
+static int span_compare(const void *a, const void *b) {
+    const Span *s = a, *t = b;
+    if (s->depth != t->depth) return s->depth > t->depth ? -1 : 1;
+    return s->start < t->start ? -1 : s->start > t->start;
+}
+
+/**
+ * Order nested plan so that paths inside a renamed directory are renamed
+ * before the directory itself is.
+ *
+ * Sequences run deepest first, by their shallowest source, so no source has
+ * moved by the time it is renamed.  Targets name files as they will be once
+ * every rename is done, so a target inside a directory whose own rename is
+ * still to come is rewritten to lie inside that directory's current path.
+ * @param   plan        Nested plan to reorder.
+ * @return  Whether or not the plan was reordered.
+ **/
+static bool plan_order(Plan *plan) {
+    size_t     n       = plan->operations.size;
+    Span      *spans   = calloc(plan->nsequences, sizeof(Span));
+    Operation *ops     = malloc(n * sizeof(Operation));
+    Index      targets = {NULL, 0};
+    bool       success = spans && ops && (plan->rewritten = calloc(n, sizeof(char *)));
+    if (!success) fprintf(stderr, "Unable to allocate: %s\n", strerror(errno));
+    if (!success || !(success = index_init(&targets, n))) goto cleanup;
+
+    for (size_t i = 0; i < plan->nsequences; i++) {
+        Span *s  = &spans[i];
+        s->start = plan->sequences[i];
+        s->end   = i + 1 < plan->nsequences ? plan->sequences[i + 1] : n;
+        s->depth = SIZE_MAX;
+        for (size_t j = s->start; j < s->end; j++) {
+            size_t depth = plan_depth(plan->operations.data[j].from);
+            if (depth < s->depth) s->depth = depth;
+        }
+    }
+    qsort(spans, plan->nsequences, sizeof(Span), span_compare);
+
+    size_t size = 0;
+    for (size_t i = 0; i < plan->nsequences; i++) {
+        plan->sequences[i] = size;
+        for (size_t j = spans[i].start; j < spans[i].end; j++) ops[size++] = plan->operations.data[j];
+    }
+    free(plan->operations.data);
+    plan->operations = (OperationList){ops, n, n};
+    ops = NULL;
+
+    // Index targets by their final names, before any is rewritten
+    for (size_t i = 0; i < n; i++) {
+        if (plan->operations.data[i].kind == OP_RENAME) *index_slot(&targets, plan->operations.data[i].to) = (Slot){plan->operations.data[i].to, i};
+    }
+
+    // Innermost directory of target still waiting for its rename holds the
+    // target at the directory's source for now
+    char prefix[BUFSIZ];
+    for (size_t i = 0; i < n && success; i++) {
+        Operation *op = &plan->operations.data[i];
+        if (op->kind != OP_RENAME) continue;
+
+        for (const char *slash = strrchr(op->to, '/'); slash && slash > op->to; ) {
+            size_t length = slash - op->to;
+            if (length < sizeof(prefix)) {
+                memcpy(prefix, op->to, length);
+                prefix[length] = 0;
+
+                ssize_t j = index_find(&targets, prefix);
+                if (j > (ssize_t)i) {
+                    if (asprintf(&plan->rewritten[i], "%s%s", plan->operations.data[j].from, slash) < 0) {
+                        fprintf(stderr, "Unable to asprintf: %s\n", strerror(errno));
+                        plan->rewritten[i] = NULL;
+                        success = false;
+                    } else {
+                        op->to = plan->rewritten[i];
+                    }
+                    break;
+                }
+            }
+            slash = memrchr(op->to, '/', length);
+        }
+    }
+
+    // Renames the rewrite turned into no-ops are dropped, along with any
+    // sequence left empty
+    size_t kept = 0, nsequences = 0;
+    for (size_t i = 0; i < plan->nsequences && success; i++) {
+        size_t start = plan->sequences[i], end = i + 1 < plan->nsequences ? plan->sequences[i + 1] : n;
+        size_t first = kept;
+        for (size_t j = start; j < end; j++) {
+            Operation *op = &plan->operations.data[j];
+            if (op->kind == OP_RENAME && streq(op->from, op->to)) {
+                free(plan->rewritten[j]);
+                continue;
+            }
+            plan->operations.data[kept] = *op;
+            plan->rewritten[kept++]     = plan->rewritten[j];
+        }
+        if (kept > first) plan->sequences[nsequences++] = first;
+    }
+    if (success) {
+        plan->operations.size = kept;
+        plan->nsequences      = nsequences;
+    }
+
+cleanup:
+    free(spans);
+    free(ops);
+    free(targets.slots);
+    return success;
+}
+
+/**
+ * Build ordered operations performing renames as if all happened at once.
+ *
+ * Every rename whose target is the source of another rename must wait for
+ * that one, so renames form chains, performed last link first, and cycles,
+ * performed as a series of exchanges.  Each chain and cycle is an
+ * independent sequence that may run concurrently with the others, unless
+ * some path lies inside a renamed directory, in which case sequences run one
+ * at a time, deepest first (see plan_order).  Duplicate sources, two sources
+ * with the same target, missing sources, and targets that exist outside of
+ * the batch are reported and nothing is planned.
+ * @param   list        Renames to plan.
+ * @param   plan        Plan to fill (paths point into list).
+ * @return  Whether or not the renames can be performed.
+ **/
+bool    plan_build(const RenameList *list, Plan *plan) {
+    size_t  n       = list->size;
+    ssize_t *next   = malloc(n * sizeof(ssize_t));
+    char    *flags  = calloc(n, 1);
+    Index    sources = {NULL, 0}, targets = {NULL, 0};
+    bool     success = next && flags && index_init(&sources, n) && index_init(&targets, n);
+
+    *plan = (Plan){{NULL, 0, 0}, NULL, 0, false, NULL};
+    if (!success) goto cleanup;
+
+    enum { SKIP = 1, PREVIOUS = 2, VISITED = 4 };
+
+    // Index sources and targets, rejecting duplicates
+    for (size_t i = 0; i < n; i++) {
+        Rename *r = &list->data[i];
+        if (streq(r->source, r->target)) {
+            flags[i] = SKIP;
+            continue;
+        }
+
+        Slot *slot = index_slot(&sources, r->source);
+        if (slot->key) {
+            fprintf(stderr, "Unable to plan: %s is renamed more than once\n", r->source);
+            success = false;
+        }
+        *slot = (Slot){r->source, i};
+
+        slot = index_slot(&targets, r->target);
+        if (slot->key) {
+            fprintf(stderr, "Unable to plan: %s and %s are both renamed to %s\n", list->data[slot->value].source, r->source, r->target);
+            success = false;
+        }
+        *slot = (Slot){r->target, i};
+    }
+
+    // Link each rename to the one that must vacate its target first
+    for (size_t i = 0; i < n && success; i++) {
+        if (flags[i] & SKIP) continue;
+
+        Rename     *r = &list->data[i];
+        struct stat s;
+        if (lstat(r->source, &s) < 0) {
+            fprintf(stderr, "Unable to rename %s: %s\n", r->source, strerror(errno));
+            success = false;
+        }
+
+        next[i] = index_find(&sources, r->target);
+        if (next[i] >= 0) {
+            flags[next[i]] |= PREVIOUS;
+        } else if (lstat(r->target, &s) == 0) {
+            fprintf(stderr, "Unable to rename %s to %s: %s\n", r->source, r->target, strerror(EEXIST));
+            success = false;
+        }
+
+        if (!plan->nested) {
+            plan->nested = plan_nested(r->source, &sources, &targets) || plan_nested(r->target, &sources, &targets);
+        }
+    }
+    if (!success) goto cleanup;
+
+    // Chains start at renames nobody waits on and run last link first
+    for (size_t i = 0; i < n && success; i++) {
+        if (flags[i] & (SKIP | PREVIOUS)) continue;
+
+        size_t start = plan->operations.size;
+        success = plan_sequence(plan);
+        for (ssize_t j = i; j >= 0 && success; j = next[j]) {
+            flags[j] |= VISITED;
+            success = operations_append(&plan->operations, OP_RENAME, list->data[j].source, list->data[j].target);
+        }
+
+        Operation *ops = plan->operations.data;
+        for (size_t a = start, b = plan->operations.size - 1; success && a < b; a++, b--) {
+            Operation op = ops[a];
+            ops[a] = ops[b];
+            ops[b] = op;
+        }
+    }
+
+    // Whatever is left forms cycles: a1 -> a2 -> ... -> ak -> a1 is done by
+    // exchanging a1 with a2, then a3, ..., then ak
+    for (size_t i = 0; i < n && success; i++) {
+        if (flags[i] & (SKIP | VISITED)) continue;
+
+        flags[i] |= VISITED;
+        success = plan_sequence(plan);
+        for (ssize_t j = next[i]; j != (ssize_t)i && success; j = next[j]) {
+            flags[j] |= VISITED;
+            success = operations_append(&plan->operations, OP_EXCHANGE, list->data[i].source, list->data[j].source);
+        }
+    }
+
+    if (success && plan->nested) success = plan_order(plan);
+
+cleanup:
+    free(sources.slots);
+    free(targets.slots);
+    free(next);
+    free(flags);
+    if (!success) plan_delete(plan);
+    return success;
+}
+
+/**
+ * Release operations and sequences of plan.
+ * @param   plan        Plan to release.
+ **/
+void    plan_delete(Plan *plan) {
+    for (size_t i = 0; plan->rewritten && i < plan->operations.size; i++) free(plan->rewritten[i]);
+    free(plan->rewritten);
+    free(plan->operations.data);
+    free(plan->sequences);
+    *plan = (Plan){{NULL, 0, 0}, NULL, 0, false, NULL};
+}
+
+/**
+ * Plan and perform renames, rolling every one of them back if any fails.
+ * @param   list        Renames to perform.
+ * @param   path        Path of journal file (NULL to keep it in memory only).
+ * @param   threads     Number of worker threads.
+ * @return  Whether or not all renames were performed.
+ **/
+bool    plan_run(const RenameList *list, const char *path, int threads) {
+    Plan    plan;
+    Journal journal;
+    if (!plan_build(list, &plan)) return false;
+    if (!journal_open(&journal, path)) {
+        plan_delete(&plan);
+        return false;
+    }
+
+    bool success = plan_execute(&plan, &journal, threads);
+    if (!success && journal_rollback(&journal)) {
+        fprintf(stderr, "Rolled back every rename\n");
+    }
+
+    journal_close(&journal);
+    plan_delete(&plan);
+    return success;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
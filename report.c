@@ -0,0 +1,333 @@
+/* report.c: Statistics and export of repeated runs */
+
+#include "timeit.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+
+/* Constants */
+
+enum {
+    METRIC_ELAPSED,
+    METRIC_USER,
+    METRIC_SYSTEM,
+    METRIC_MAX_RSS,
+    METRIC_MINOR_FAULTS,
+    METRIC_MAJOR_FAULTS,
+    METRIC_VOLUNTARY,
+    METRIC_INVOLUNTARY,
+    METRIC_TASK_CLOCK,      // First perf counter, in COUNTER_* order
+    METRIC_CYCLES,
+    METRIC_INSTRUCTIONS,
+    METRIC_CACHE_MISSES,
+    NMETRICS,
+};
+
+static const struct {
+    const char *name;       // Key in exported data
+    const char *label;      // Label in summary
+    int         precision;  // Decimal places in summary (exports keep three more)
+} Metrics[NMETRICS] = {
+    [METRIC_ELAPSED]        = {"elapsed",              "Time Elapsed",         3},
+    [METRIC_USER]           = {"user",                 "User Time",            3},
+    [METRIC_SYSTEM]         = {"system",               "System Time",          3},
+    [METRIC_MAX_RSS]        = {"max_rss_kb",           "Max RSS (KB)",         0},
+    [METRIC_MINOR_FAULTS]   = {"minor_faults",         "Minor Faults",         0},
+    [METRIC_MAJOR_FAULTS]   = {"major_faults",         "Major Faults",         0},
+    [METRIC_VOLUNTARY]      = {"voluntary_switches",   "Voluntary Switches",   0},
+    [METRIC_INVOLUNTARY]    = {"involuntary_switches", "Involuntary Switches", 0},
+    [METRIC_TASK_CLOCK]     = {"task_clock_ms",        "Task Clock (ms)",      3},
+    [METRIC_CYCLES]         = {"cycles",               "Cycles",               0},
+    [METRIC_INSTRUCTIONS]   = {"instructions",         "Instructions",         0},
+    [METRIC_CACHE_MISSES]   = {"cache_misses",         "Cache Misses",         0},
+};
+
+/* Metric Functions */
+
+/**
+ * Extract metric from measurement.
+ * @param   measurement Measurement of single run.
+ * @param   metric      METRIC_* value.
+ * @param   value       Set to value of metric.
+ * @return  Whether or not the run has the metric.
+ **/
+static bool metric_value(const Measurement *measurement, int metric, double *value) {
+    const struct rusage *usage = &measurement->usage;
+
+    switch (metric) {
+        case METRIC_ELAPSED:        *value = measurement->elapsed; break;
+        case METRIC_USER:           *value = usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1000000.0; break;
+        case METRIC_SYSTEM:         *value = usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1000000.0; break;
+        case METRIC_MAX_RSS:        *value = usage->ru_maxrss; break;
+        case METRIC_MINOR_FAULTS:   *value = usage->ru_minflt; break;
+        case METRIC_MAJOR_FAULTS:   *value = usage->ru_majflt; break;
+        case METRIC_VOLUNTARY:      *value = usage->ru_nvcsw; break;
+        case METRIC_INVOLUNTARY:    *value = usage->ru_nivcsw; break;
+        default: {
+            int counter = metric - METRIC_TASK_CLOCK;
+            if (!measurement->counted || !measurement->counters.valid[counter]) return false;
+            *value = measurement->counters.values[counter];
+            if (counter == COUNTER_TASK_CLOCK) *value /= 1000000.0;
+        }
+    }
+    return true;
+}
+
+/**
+ * Extract metric from every run.
+ * @param   measurements    Measurements of runs.
+ * @param   n               Number of runs.
+ * @param   metric          METRIC_* value.
+ * @param   values          Array of n values to fill in.
+ * @return  Whether or not every run has the metric.
+ **/
+static bool metric_values(const Measurement *measurements, size_t n, int metric, double *values) {
+    for (size_t i = 0; i < n; i++) {
+        if (!metric_value(&measurements[i], metric, &values[i])) return false;
+    }
+    return true;
+}
+
+/* Statistics Functions */
+
+/**
+ * Compare two doubles for qsort.
+ **/
+static int double_compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Interpolate quantile of sorted values.
+ * @param   sorted      Values in ascending order.
+ * @param   n           Number of values.
+ * @param   q           Quantile between 0 and 1.
+ * @return  Value at quantile.
+ **/
+static double quantile(const double *sorted, size_t n, double q) {
+    double position = q * (n - 1);
+    size_t index    = position;
+    if (index + 1 >= n) return sorted[n - 1];
+    return sorted[index] + (position - index) * (sorted[index + 1] - sorted[index]);
+}
+
+/**
+ * Summarize values, counting as outliers those beyond 1.5 interquartile
+ * ranges from the first or third quartile (Tukey's fences).
+ * @param   values      Array of values.
+ * @param   n           Number of values (at least one).
+ * @param   summary     Summary to fill in.
+ * @return  Whether or not the values were summarized.
+ **/
+bool    summary_compute(const double *values, size_t n, Summary *summary) {
+    double *sorted = malloc(n * sizeof(double));
+    if (sorted == NULL) {
+        fprintf(stderr, "Unable to malloc: %s\n", strerror(errno));
+        return false;
+    }
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), double_compare);
+
+    double sum = 0, squares = 0;
+    for (size_t i = 0; i < n; i++) sum += sorted[i];
+    summary->mean = sum / n;
+    for (size_t i = 0; i < n; i++) squares += (sorted[i] - summary->mean) * (sorted[i] - summary->mean);
+    summary->stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+
+    summary->median = quantile(sorted, n, 0.5);
+    summary->min    = sorted[0];
+    summary->max    = sorted[n - 1];
+
+    double q1 = quantile(sorted, n, 0.25), q3 = quantile(sorted, n, 0.75);
+    summary->lower    = q1 - 1.5 * (q3 - q1);
+    summary->upper    = q3 + 1.5 * (q3 - q1);
+    summary->outliers = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (sorted[i] < summary->lower || sorted[i] > summary->upper) summary->outliers++;
+    }
+
+    free(sorted);
+    return true;
+}
+
+/**
+ * Print summary of every metric all runs have.
+ * @param   stream          Stream to print to.
+ * @param   measurements    Measurements of runs.
+ * @param   n               Number of runs.
+ * @param   warmups         Number of unmeasured runs before them.
+ **/
+void    summary_print(FILE *stream, const Measurement *measurements, size_t n, int warmups) {
+    double *values = malloc(n * sizeof(double));
+    if (values == NULL) {
+        fprintf(stderr, "Unable to malloc: %s\n", strerror(errno));
+        return;
+    }
+
+    size_t failures = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!WIFEXITED(measurements[i].status) || WEXITSTATUS(measurements[i].status) != 0) failures++;
+    }
+
+    fprintf(stream, "Runs:                 %zu (%d warmup, %zu failed)\n", n, warmups, failures);
+    fprintf(stream, "%-22s%15s%15s%15s%15s%15s\n", "", "Mean", "Stddev", "Median", "Min", "Max");
+
+    Summary elapsed = {0};
+    for (int metric = 0; metric < NMETRICS; metric++) {
+        Summary summary;
+        if (!metric_values(measurements, n, metric, values) || !summary_compute(values, n, &summary)) continue;
+        if (metric == METRIC_ELAPSED) elapsed = summary;
+
+        int precision = Metrics[metric].precision;
+        fprintf(stream, "%s:%*s%15.*lf%15.*lf%15.*lf%15.*lf%15.*lf\n",
+            Metrics[metric].label, (int)(21 - strlen(Metrics[metric].label)), "",
+            precision, summary.mean, precision, summary.stddev, precision, summary.median,
+            precision, summary.min, precision, summary.max);
+    }
+
+    if (elapsed.outliers) {
+        fprintf(stream, "Outliers:             %zu of %zu runs outside %0.3lf to %0.3lf seconds\n",
+            elapsed.outliers, n, elapsed.lower, elapsed.upper);
+    }
+    free(values);
+}
+
+/* Export Functions */
+
+/**
+ * Write string as JSON string literal.
+ * @param   stream      Stream to write to.
+ * @param   s           String to write.
+ **/
+static void json_string(FILE *stream, const char *s) {
+    fputc('"', stream);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(stream, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(stream, "\\u%04x", *s);
+        } else {
+            fputc(*s, stream);
+        }
+    }
+    fputc('"', stream);
+}
+
+/**
+ * Write metric of run, or nothing (CSV) or null (JSON) if it lacks it.
+ * @param   stream      Stream to write to.
+ * @param   measurement Measurement of run.
+ * @param   metric      METRIC_* value.
+ * @param   json        Whether or not output is JSON.
+ **/
+static void export_value(FILE *stream, const Measurement *measurement, int metric, bool json) {
+    double value;
+    int    precision = Metrics[metric].precision;
+    if (metric_value(measurement, metric, &value)) {
+        fprintf(stream, "%.*lf", precision ? precision + 3 : 0, value);
+    } else if (json) {
+        fputs("null", stream);
+    }
+}
+
+/**
+ * Export every run as CSV, one row per run.
+ **/
+static void export_csv(FILE *stream, const Measurement *measurements, size_t n, int nmetrics) {
+    fputs("run,exit,signal", stream);
+    for (int metric = 0; metric < nmetrics; metric++) fprintf(stream, ",%s", Metrics[metric].name);
+    fputc('\n', stream);
+
+    for (size_t i = 0; i < n; i++) {
+        int status = measurements[i].status;
+        fprintf(stream, "%zu,%d,%d", i + 1, WIFEXITED(status) ? WEXITSTATUS(status) : -1, WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        for (int metric = 0; metric < nmetrics; metric++) {
+            fputc(',', stream);
+            export_value(stream, &measurements[i], metric, false);
+        }
+        fputc('\n', stream);
+    }
+}
+
+/**
+ * Export command, every run, and summary of each metric as JSON.
+ **/
+static void export_json(FILE *stream, char **command, const Measurement *measurements, size_t n, int nmetrics, double *values) {
+    fputs("{\n  \"command\": [", stream);
+    for (size_t i = 0; command[i]; i++) {
+        if (i) fputs(", ", stream);
+        json_string(stream, command[i]);
+    }
+
+    fputs("],\n  \"runs\": [\n", stream);
+    for (size_t i = 0; i < n; i++) {
+        int status = measurements[i].status;
+        fprintf(stream, "    {\"exit\": %d, \"signal\": %d", WIFEXITED(status) ? WEXITSTATUS(status) : -1, WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        for (int metric = 0; metric < nmetrics; metric++) {
+            fprintf(stream, ", \"%s\": ", Metrics[metric].name);
+            export_value(stream, &measurements[i], metric, true);
+        }
+        fprintf(stream, "}%s\n", i + 1 < n ? "," : "");
+    }
+
+    fputs("  ],\n  \"summary\": {", stream);
+    bool first = true;
+    for (int metric = 0; metric < nmetrics; metric++) {
+        Summary summary;
+        if (!metric_values(measurements, n, metric, values) || !summary_compute(values, n, &summary)) continue;
+
+        int precision = Metrics[metric].precision ? Metrics[metric].precision + 3 : 0;
+        fprintf(stream, "%s\n    \"%s\": {\"mean\": %.*lf, \"stddev\": %.*lf, \"median\": %.*lf, \"min\": %.*lf, \"max\": %.*lf, \"outliers\": %zu}",
+            first ? "" : ",", Metrics[metric].name,
+            precision, summary.mean, precision, summary.stddev, precision, summary.median,
+            precision, summary.min, precision, summary.max, summary.outliers);
+        first = false;
+    }
+    fputs("\n  }\n}\n", stream);
+}
+
+/**
+ * Export every measured run to file.
+ * @param   path            Path of file to write.
+ * @param   format          "csv" or "json".
+ * @param   command         Array of strings representing command measured.
+ * @param   measurements    Measurements of runs.
+ * @param   n               Number of runs.
+ * @return  Whether or not the file was written.
+ **/
+bool    report_export(const char *path, const char *format, char **command, const Measurement *measurements, size_t n) {
+    // Counter columns only appear when any run was counted
+    int nmetrics = METRIC_TASK_CLOCK;
+    for (size_t i = 0; i < n; i++) {
+        if (measurements[i].counted) nmetrics = NMETRICS;
+    }
+
+    double *values = malloc(n * sizeof(double));
+    FILE   *stream = fopen(path, "w");
+    if (values == NULL || stream == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        free(values);
+        if (stream) fclose(stream);
+        return false;
+    }
+
+    if (streq(format, "json")) {
+        export_json(stream, command, measurements, n, nmetrics, values);
+    } else {
+        export_csv(stream, measurements, n, nmetrics);
+    }
+
+    free(values);
+    if (fclose(stream) == EOF) {
+        fprintf(stderr, "Unable to write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
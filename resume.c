@@ -0,0 +1,91 @@
+/* resume.c: Resumable downloads */
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+/* Functions */
+
+/**
+ * Download URL to file, continuing a previous partial download of it.
+ *
+ * While a download is in progress, the validators of the body are kept in a
+ * sidecar file next to the output.  When both the partial file and the
+ * sidecar exist, only the missing bytes are requested with Range, guarded by
+ * If-Range so that a body which changed in the meantime is sent whole
+ * instead.  The sidecar is removed once the file is complete.
+ * @param   pool        Connection pool
+ * @param   url         URL to download
+ * @param   path        Path of output file
+ * @param   fd          File descriptor of output file (opened without truncation)
+ * @param   stats       Transfer statistics to update
+ * @return  true if the file holds the whole body, otherwise false
+ **/
+bool fetch_resume(Pool *pool, URL *url, const char *path, int fd, Stats *stats) {
+    char sidecar[PATH_MAX + 8];
+    snprintf(sidecar, sizeof(sidecar), "%s%s", path, RESUME_SUFFIX);
+
+    struct stat s;
+    if (fstat(fd, &s) < 0) {
+        fprintf(stderr, "Unable to fstat %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // Ask for the rest of the body only if the partial file can be validated
+    char etag[HTTP_VALUE_MAX] = "", modified[HTTP_VALUE_MAX] = "";
+    char headers[HTTP_VALUE_MAX + BUFSIZ] = "";
+    bool partial = s.st_size > 0 && validators_load(sidecar, url, etag, modified);
+
+    // If-Range only accepts strong ETags
+    const char *validator = *etag && strncmp(etag, "W/", 2) != 0 ? etag : modified;
+    partial = partial && *validator;
+    if (partial) {
+        snprintf(headers, sizeof(headers), "Range: bytes=%lld-\r\nIf-Range: %s\r\n", (long long)s.st_size, validator);
+    } else if (s.st_size > 0) {
+        fprintf(stderr, "Unable to validate partial %s, fetching whole body\n", path);
+    }
+
+    Response    r;
+    Connection *c = request_open(pool, url, "GET", headers, &r);
+    if (c == NULL) return false;
+
+    // Partial file already holds the whole body
+    if (partial && r.status == 416 && r.total == s.st_size) {
+        request_body(pool, c, &r, NULL, stats);
+        unlink(sidecar);
+        return true;
+    }
+
+    Sink sink = {fd, 0};
+    if (partial && r.status == 206 && r.offset == s.st_size) {
+        sink.offset = s.st_size;
+    } else if (r.status == 200) {
+        if (s.st_size > 0 && ftruncate(fd, 0) < 0) {
+            fprintf(stderr, "Unable to ftruncate %s: %s\n", path, strerror(errno));
+            pool_release(pool, c, false);
+            return false;
+        }
+    } else {
+        fprintf(stderr, "Unable to fetch %s:%s/%s: status %d\n", url->host, url->port, url->path, r.status);
+        request_body(pool, c, &r, NULL, stats);
+        return false;
+    }
+
+    // Without validators, a later resume could not trust the partial file
+    if (*r.etag || *r.modified) {
+        validators_store(sidecar, url, &r);
+    } else {
+        unlink(sidecar);
+    }
+
+    if (!request_body(pool, c, &r, &sink, stats)) return false;
+    unlink(sidecar);
+    return true;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
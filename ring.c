@@ -0,0 +1,596 @@
+/* ring.c: Asynchronous socket I/O (io_uring with epoll fallback) */
+
+#include "socket.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define BILLION         1000000000
+#define MILLION         1000000
+#define THOUSAND        1000
+
+/* Operations */
+
+enum {
+    OP_CONNECT,
+    OP_SEND,
+    OP_RECV,
+};
+
+typedef struct Op Op;
+struct Op {
+    int         kind;       // OP_CONNECT, OP_SEND or OP_RECV
+    int         fd;         // Socket file descriptor
+    void       *data;       // Caller data pointer
+    void       *buffer;     // Buffer to send from or receive into
+    size_t      size;       // Size of buffer
+    Op         *prev;       // Previous pending operation (epoll)
+    Op         *next;       // Next pending or free operation (epoll)
+};
+
+/* Ring Structure */
+
+struct Ring {
+    int                     backend;    // RING_URING or RING_EPOLL
+
+    // io_uring
+    int                     fd;         // Ring file descriptor
+    unsigned               *sq_head;    // Submission queue head (kernel)
+    unsigned               *sq_tail;    // Submission queue tail (us)
+    unsigned               *sq_mask;    // Submission queue index mask
+    unsigned               *sq_array;   // Submission queue index array
+    unsigned               *cq_head;    // Completion queue head (us)
+    unsigned               *cq_tail;    // Completion queue tail (kernel)
+    unsigned               *cq_mask;    // Completion queue index mask
+    struct io_uring_sqe    *sqes;       // Submission queue entries
+    struct io_uring_cqe    *cqes;       // Completion queue entries
+    void                   *sq_ptr;     // Mapped submission queue ring
+    size_t                  sq_size;    // Size of mapped submission ring
+    void                   *cq_ptr;     // Mapped completion queue ring
+    size_t                  cq_size;    // Size of mapped completion ring
+    size_t                  sqes_size;  // Size of mapped entries
+    unsigned                entries;    // Number of submission entries
+    unsigned                queued;     // Entries not yet submitted
+    Address                *addresses;  // Connect addresses by entry index
+
+    // epoll
+    int                     epfd;       // Epoll file descriptor
+    int                     tfd;        // Timer for sub-millisecond waits
+    Op                     *pending;    // Operations waiting for readiness
+    Op                     *free;       // Recycled operation structures
+    Completion             *ready;      // Completions not yet returned
+    size_t                  nready;     // Number of ready completions
+    size_t                  cready;     // Capacity of ready completions
+};
+
+/* io_uring Functions */
+
+/**
+ * Setup io_uring instance and map its queues.
+ * @param   r           Ring to initialize
+ * @param   entries     Number of submission entries
+ * @return  true if io_uring is available, otherwise false
+ **/
+static bool uring_setup(Ring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) return false;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(r->fd);
+        return false;
+    }
+
+    // Map submission and completion rings (single mapping) and entries
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+    r->cq_size = 0;
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        close(r->fd);
+        return false;
+    }
+    r->cq_ptr = r->sq_ptr;
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->sq_ptr, r->sq_size);
+        close(r->fd);
+        return false;
+    }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->entries  = p.sq_entries;
+
+    if ((r->addresses = calloc(r->entries, sizeof(Address))) == NULL) {
+        munmap(r->sqes, r->sqes_size);
+        munmap(r->sq_ptr, r->sq_size);
+        close(r->fd);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Submit queued entries and optionally wait for completions.
+ * @param   r           Ring
+ * @param   wait        Minimum number of completions to wait for
+ * @param   timeout     Maximum time to wait in microseconds (-1 is forever)
+ * @return  0 on success (or timeout), otherwise -errno
+ **/
+static int uring_enter(Ring *r, unsigned wait, int64_t timeout) {
+    struct __kernel_timespec            ts;
+    struct io_uring_getevents_arg       arg = {.sigmask_sz = _NSIG / 8};
+    unsigned                            flags = IORING_ENTER_EXT_ARG;
+
+    if (wait > 0) flags |= IORING_ENTER_GETEVENTS;
+    if (wait > 0 && timeout >= 0) {
+        ts.tv_sec  = timeout / MILLION;
+        ts.tv_nsec = (timeout % MILLION) * THOUSAND;
+        arg.ts     = (uint64_t)(uintptr_t)&ts;
+    }
+
+    int n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait, flags, &arg, sizeof(arg));
+    if (n < 0) {
+        if (errno == ETIME || errno == EINTR) return 0;
+        return -errno;
+    }
+    r->queued -= (unsigned)n < r->queued ? (unsigned)n : r->queued;
+    return 0;
+}
+
+/**
+ * Reserve next submission queue entry, flushing queue if it is full.
+ * @param   r           Ring
+ * @param   index       Pointer to store entry index
+ * @return  Pointer to cleared entry, or NULL on failure
+ **/
+static struct io_uring_sqe *uring_sqe(Ring *r, unsigned *index) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    if (tail - head >= r->entries) {
+        if (uring_enter(r, 0, -1) < 0) return NULL;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= r->entries) return NULL;
+    }
+
+    *index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[*index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * Publish reserved submission queue entry (submitted on next enter).
+ * @param   r           Ring
+ * @param   index       Entry index
+ **/
+static void uring_push(Ring *r, unsigned index) {
+    unsigned tail = *r->sq_tail;
+    r->sq_array[tail & *r->sq_mask] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+}
+
+/**
+ * Queue socket operation on io_uring.
+ * @param   r           Ring
+ * @param   opcode      IORING_OP_* operation code
+ * @param   fd          Socket file descriptor
+ * @param   address     Address to connect to (IORING_OP_CONNECT only)
+ * @param   buffer      Buffer (IORING_OP_SEND and IORING_OP_RECV only)
+ * @param   size        Size of buffer
+ * @param   data        Caller data pointer
+ * @return  true if operation was queued, otherwise false
+ **/
+static bool uring_queue(Ring *r, int opcode, int fd, const Address *address, void *buffer, size_t size, void *data) {
+    unsigned index;
+    struct io_uring_sqe *sqe = uring_sqe(r, &index);
+    if (sqe == NULL) return false;
+
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->user_data = (uint64_t)(uintptr_t)data;
+    if (opcode == IORING_OP_CONNECT) {
+        // Address is read when the entry is submitted, so keep a copy
+        r->addresses[index] = *address;
+        sqe->addr = (uint64_t)(uintptr_t)&r->addresses[index].addr;
+        sqe->off  = address->addrlen;
+    } else {
+        sqe->addr      = (uint64_t)(uintptr_t)buffer;
+        sqe->len       = size;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+
+    uring_push(r, index);
+    return true;
+}
+
+/* epoll Functions */
+
+/**
+ * Append completion to list of ready completions.
+ * @param   r           Ring
+ * @param   data        Caller data pointer
+ * @param   result      Operation result
+ * @return  true if completion was recorded, otherwise false
+ **/
+static bool epoll_ready(Ring *r, void *data, int result) {
+    if (r->nready == r->cready) {
+        size_t      capacity = r->cready ? 2 * r->cready : 64;
+        Completion *ready    = realloc(r->ready, capacity * sizeof(Completion));
+        if (ready == NULL) return false;
+        r->ready  = ready;
+        r->cready = capacity;
+    }
+    r->ready[r->nready++] = (Completion){.data = data, .result = result};
+    return true;
+}
+
+/**
+ * Attempt operation without blocking.
+ * @param   op          Operation to perform
+ * @return  Result of operation, or -EAGAIN if socket is not ready
+ **/
+static int epoll_attempt(Op *op) {
+    ssize_t n;
+    switch (op->kind) {
+        case OP_CONNECT:
+            n = socket_error(op->fd);
+            return n == EINPROGRESS || n == EALREADY ? -EAGAIN : -n;
+        case OP_SEND:
+            n = send(op->fd, op->buffer, op->size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            break;
+        default:
+            n = recv(op->fd, op->buffer, op->size, MSG_DONTWAIT);
+            break;
+    }
+    if (n < 0) return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+    return n;
+}
+
+/**
+ * Wait for socket readiness to perform operation.
+ * @param   r           Ring
+ * @param   kind        OP_CONNECT, OP_SEND or OP_RECV
+ * @param   fd          Socket file descriptor
+ * @param   buffer      Buffer to send from or receive into
+ * @param   size        Size of buffer
+ * @param   data        Caller data pointer
+ * @return  true if operation is pending, otherwise false
+ **/
+static bool epoll_pend(Ring *r, int kind, int fd, void *buffer, size_t size, void *data) {
+    Op *op = r->free;
+    if (op) r->free = op->next;
+    else if ((op = calloc(1, sizeof(Op))) == NULL) return false;
+
+    *op = (Op){.kind = kind, .fd = fd, .data = data, .buffer = buffer, .size = size};
+
+    struct epoll_event ev = {
+        .events   = (kind == OP_RECV ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT,
+        .data.ptr = op,
+    };
+    if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+        (errno != ENOENT || epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)) {
+        op->next = r->free;
+        r->free  = op;
+        return false;
+    }
+
+    op->prev = NULL;
+    op->next = r->pending;
+    if (r->pending) r->pending->prev = op;
+    r->pending = op;
+    return true;
+}
+
+/**
+ * Remove operation from pending list and recycle it.
+ * @param   r           Ring
+ * @param   op          Operation to release
+ **/
+static void epoll_release(Ring *r, Op *op) {
+    if (op->prev) op->prev->next = op->next;
+    else          r->pending     = op->next;
+    if (op->next) op->next->prev = op->prev;
+
+    op->next = r->free;
+    r->free  = op;
+}
+
+/**
+ * Perform operation now or once its socket is ready.
+ * @param   r           Ring
+ * @param   kind        OP_CONNECT, OP_SEND or OP_RECV
+ * @param   fd          Socket file descriptor
+ * @param   buffer      Buffer to send from or receive into
+ * @param   size        Size of buffer
+ * @param   data        Caller data pointer
+ * @return  true if operation completed or is pending, otherwise false
+ **/
+static bool epoll_queue(Ring *r, int kind, int fd, void *buffer, size_t size, void *data) {
+    Op  op = {.kind = kind, .fd = fd, .buffer = buffer, .size = size};
+    int result = epoll_attempt(&op);
+    if (result == -EAGAIN) return epoll_pend(r, kind, fd, buffer, size, data);
+    return epoll_ready(r, data, result);
+}
+
+/**
+ * Wait for readiness and perform pending operations.
+ * @param   r           Ring
+ * @param   timeout     Maximum time to wait in microseconds (-1 is forever)
+ * @return  0 on success (or timeout), otherwise -errno
+ **/
+static int epoll_poll(Ring *r, int64_t timeout) {
+    // Arm timer for sub-millisecond precision
+    if (timeout > 0) {
+        struct itimerspec its = {
+            .it_value = {.tv_sec = timeout / MILLION, .tv_nsec = (timeout % MILLION) * THOUSAND},
+        };
+        timerfd_settime(r->tfd, 0, &its, NULL);
+    }
+
+    // Positive timeouts are left to the timer
+    struct epoll_event events[64];
+    int n = epoll_wait(r->epfd, events, 64, timeout == 0 ? 0 : -1);
+    if (n < 0) return errno == EINTR ? 0 : -errno;
+
+    for (int i = 0; i < n; i++) {
+        Op *op = events[i].data.ptr;
+        if (op == NULL) {
+            uint64_t expirations;
+            if (read(r->tfd, &expirations, sizeof(expirations)) < 0) {}
+            continue;
+        }
+
+        int result = epoll_attempt(op);
+        if (result == -EAGAIN) {
+            struct epoll_event ev = {
+                .events   = (op->kind == OP_RECV ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT,
+                .data.ptr = op,
+            };
+            if (epoll_ctl(r->epfd, EPOLL_CTL_MOD, op->fd, &ev) == 0) continue;
+            result = -errno;
+        }
+
+        epoll_ready(r, op->data, result);
+        epoll_release(r, op);
+    }
+
+    if (timeout > 0) {
+        struct itimerspec its = {{0}};
+        timerfd_settime(r->tfd, 0, &its, NULL);
+    }
+    return 0;
+}
+
+/* Ring Functions */
+
+/**
+ * Create asynchronous I/O ring.
+ *
+ * RING_URING falls back to RING_EPOLL when io_uring is unavailable (old
+ * kernel, seccomp, or disabled by sysctl); check ring_backend().
+ * @param   entries     Expected number of concurrent operations
+ * @param   backend     RING_URING or RING_EPOLL
+ * @return  Newly allocated ring (must be deleted), otherwise NULL
+ **/
+Ring *ring_create(unsigned entries, int backend) {
+    Ring *r = calloc(1, sizeof(Ring));
+    if (r == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    r->fd = r->epfd = r->tfd = -1;
+
+    if (backend == RING_URING && uring_setup(r, entries ? entries : 1)) {
+        r->backend = RING_URING;
+        return r;
+    }
+
+    r->backend = RING_EPOLL;
+    r->epfd    = epoll_create1(EPOLL_CLOEXEC);
+    r->tfd     = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (r->epfd < 0 || r->tfd < 0 || epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->tfd, &ev) < 0) {
+        fprintf(stderr, "Unable to setup event loop: %s\n", strerror(errno));
+        ring_delete(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * Deallocate ring (pending operations are abandoned).
+ * @param   ring        Ring to delete
+ **/
+void ring_delete(Ring *ring) {
+    if (ring == NULL) return;
+
+    if (ring->backend == RING_URING) {
+        munmap(ring->sqes, ring->sqes_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->fd);
+        free(ring->addresses);
+    } else {
+        for (Op *lists[] = {ring->pending, ring->free}, **l = lists; l < lists + 2; l++) {
+            while (*l) {
+                Op *next = (*l)->next;
+                free(*l);
+                *l = next;
+            }
+        }
+        free(ring->ready);
+        if (ring->epfd >= 0) close(ring->epfd);
+        if (ring->tfd >= 0) close(ring->tfd);
+    }
+    free(ring);
+}
+
+/**
+ * Return backend used by ring.
+ * @param   ring        Ring
+ * @return  RING_URING or RING_EPOLL
+ **/
+int ring_backend(Ring *ring) {
+    return ring->backend;
+}
+
+/**
+ * Queue connect of non-blocking socket.
+ *
+ * Each data pointer may have at most one operation outstanding.
+ * @param   ring        Ring
+ * @param   fd          Non-blocking socket file descriptor
+ * @param   address     Address to connect to
+ * @param   data        Data pointer returned with completion
+ * @return  true if operation was queued, otherwise false
+ **/
+bool ring_connect(Ring *ring, int fd, const Address *address, void *data) {
+    if (ring->backend == RING_URING) {
+        return uring_queue(ring, IORING_OP_CONNECT, fd, address, NULL, 0, data);
+    }
+
+    if (connect(fd, (struct sockaddr *)&address->addr, address->addrlen) == 0) return epoll_ready(ring, data, 0);
+    if (errno != EINPROGRESS) return epoll_ready(ring, data, -errno);
+    return epoll_pend(ring, OP_CONNECT, fd, NULL, 0, data);
+}
+
+/**
+ * Queue send on connected socket.
+ * @param   ring        Ring
+ * @param   fd          Socket file descriptor
+ * @param   buffer      Data to send (must stay valid until completion)
+ * @param   size        Number of bytes to send
+ * @param   data        Data pointer returned with completion
+ * @return  true if operation was queued, otherwise false
+ **/
+bool ring_send(Ring *ring, int fd, const void *buffer, size_t size, void *data) {
+    if (ring->backend == RING_URING) {
+        return uring_queue(ring, IORING_OP_SEND, fd, NULL, (void *)buffer, size, data);
+    }
+    return epoll_queue(ring, OP_SEND, fd, (void *)buffer, size, data);
+}
+
+/**
+ * Queue receive on connected socket.
+ * @param   ring        Ring
+ * @param   fd          Socket file descriptor
+ * @param   buffer      Buffer to receive into (must stay valid until completion)
+ * @param   size        Size of buffer
+ * @param   data        Data pointer returned with completion
+ * @return  true if operation was queued, otherwise false
+ **/
+bool ring_recv(Ring *ring, int fd, void *buffer, size_t size, void *data) {
+    if (ring->backend == RING_URING) {
+        return uring_queue(ring, IORING_OP_RECV, fd, NULL, buffer, size, data);
+    }
+    return epoll_queue(ring, OP_RECV, fd, buffer, size, data);
+}
+
+/**
+ * Cancel outstanding operation.
+ *
+ * The operation still completes, with -ECANCELED unless it finished first.
+ * @param   ring        Ring
+ * @param   data        Data pointer of operation to cancel
+ * @return  true if cancellation was queued, otherwise false
+ **/
+bool ring_cancel(Ring *ring, void *data) {
+    if (ring->backend == RING_URING) {
+        unsigned index;
+        struct io_uring_sqe *sqe = uring_sqe(ring, &index);
+        if (sqe == NULL) return false;
+
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->fd        = -1;
+        sqe->addr      = (uint64_t)(uintptr_t)data;
+        sqe->user_data = 0;     /* Result of cancel itself is ignored */
+        uring_push(ring, index);
+        return true;
+    }
+
+    for (Op *op = ring->pending; op; op = op->next) {
+        if (op->data != data) continue;
+        epoll_ctl(ring->epfd, EPOLL_CTL_DEL, op->fd, NULL);
+        epoll_ready(ring, data, -ECANCELED);
+        epoll_release(ring, op);
+        return true;
+    }
+    return true;    /* Already completed */
+}
+
+/**
+ * Submit queued operations and wait for completions.
+ * @param   ring        Ring
+ * @param   completions Array to store completions
+ * @param   max         Size of completions array
+ * @param   timeout     Maximum time to wait in microseconds (-1 is forever)
+ * @return  Number of completions stored (0 on timeout), otherwise -1
+ **/
+int ring_wait(Ring *ring, Completion *completions, int max, int64_t timeout) {
+    int n = 0;
+
+    if (ring->backend == RING_URING) {
+        // Submit queued entries, waiting only if nothing has completed yet
+        unsigned head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) || ring->queued > 0) {
+            bool wait   = head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+            int  status = uring_enter(ring, wait ? 1 : 0, timeout);
+            if (status < 0) {
+                errno = -status;
+                return -1;
+            }
+        }
+
+        // Reap completions (results of cancellations are skipped, so this
+        // may return 0 before the timeout expires)
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail && n < max; head++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            if (cqe->user_data == 0) continue;
+            completions[n++] = (Completion){.data = (void *)(uintptr_t)cqe->user_data, .result = cqe->res};
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    if (ring->nready == 0) {
+        int status = epoll_poll(ring, timeout);
+        if (status < 0) {
+            errno = -status;
+            return -1;
+        }
+    }
+
+    n = ring->nready < (size_t)max ? (int)ring->nready : max;
+    memcpy(completions, ring->ready, n * sizeof(Completion));
+    memmove(ring->ready, ring->ready + n, (ring->nready - n) * sizeof(Completion));
+    ring->nready -= n;
+    return n;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,187 @@
+/* sample.c: Periodic /proc samples of a command's process group */
+
+#include "timeit.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Functions */
+
+/**
+ * Add CPU time of process to sample if it belongs to process group.
+ * @param   pid         Process to read.
+ * @param   pgid        Process group sampled.
+ * @param   sample      Sample to add to.
+ * @return  Whether or not the process belongs to the group.
+ **/
+static bool sample_stat(pid_t pid, pid_t pgid, Sample *sample) {
+    char path[64], buffer[BUFSIZ];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return false;
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    fclose(fp);
+    buffer[n] = 0;
+
+    // Command name is in parentheses and may itself contain spaces
+    char *fields = strrchr(buffer, ')');
+    int   pgrp;
+    unsigned long utime, stime;
+    long  cutime, cstime;
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+        &pgrp, &utime, &stime, &cutime, &cstime) != 5 || pgrp != pgid) return false;
+
+    // Reaped children fold their time into cutime and cstime
+    sample->cpu += (double)(utime + stime + cutime + cstime) / sysconf(_SC_CLK_TCK);
+    sample->processes++;
+    return true;
+}
+
+/**
+ * Add resident set size and threads of process to sample.
+ * @param   pid         Process to read.
+ * @param   sample      Sample to add to.
+ **/
+static void sample_status(pid_t pid, Sample *sample) {
+    char path[64], line[BUFSIZ];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return;
+
+    long value;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "VmRSS: %ld", &value) == 1) sample->rss += value;
+        else if (sscanf(line, "Threads: %ld", &value) == 1) sample->threads += value;
+    }
+    fclose(fp);
+}
+
+/**
+ * Add I/O counters of process to sample.
+ * @param   pid         Process to read.
+ * @param   sample      Sample to add to.
+ **/
+static void sample_io(pid_t pid, Sample *sample) {
+    char path[64], line[BUFSIZ];
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return;
+
+    uint64_t value;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "rchar: %lu", &value) == 1) sample->rchar += value;
+        else if (sscanf(line, "wchar: %lu", &value) == 1) sample->wchar += value;
+        else if (sscanf(line, "read_bytes: %lu", &value) == 1) sample->read_bytes += value;
+        else if (sscanf(line, "write_bytes: %lu", &value) == 1) sample->write_bytes += value;
+    }
+    fclose(fp);
+}
+
+/**
+ * Sum CPU time, memory, and I/O of every process in process group.
+ *
+ * Commands run in their own process group, so the group stands in for the
+ * command's process tree (children that leave it with setsid are missed).
+ * @param   pgid        Process group of command.
+ * @param   sample      Sample to fill in (time and run are left alone).
+ * @return  Whether or not /proc could be read.
+ **/
+bool    sample_group(pid_t pgid, Sample *sample) {
+    DIR *dir = opendir("/proc");
+    if (dir == NULL) {
+        fprintf(stderr, "Unable to opendir /proc: %s\n", strerror(errno));
+        return false;
+    }
+
+    sample->processes   = 0;
+    sample->threads     = 0;
+    sample->cpu         = 0;
+    sample->rss         = 0;
+    sample->rchar       = 0;
+    sample->wchar       = 0;
+    sample->read_bytes  = 0;
+    sample->write_bytes = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (!isdigit(entry->d_name[0])) continue;
+
+        pid_t pid = atoi(entry->d_name);
+        if (!sample_stat(pid, pgid, sample)) continue;
+        sample_status(pid, sample);
+        sample_io(pid, sample);
+    }
+
+    closedir(dir);
+    return true;
+}
+
+/**
+ * Append sample to list.
+ * @param   list        List of samples.
+ * @param   sample      Sample to append.
+ * @return  Whether or not the sample was appended.
+ **/
+bool    samples_append(SampleList *list, const Sample *sample) {
+    if (list->size == list->capacity) {
+        size_t  capacity = list->capacity ? 2 * list->capacity : 64;
+        Sample *data     = realloc(list->data, capacity * sizeof(Sample));
+        if (data == NULL) {
+            fprintf(stderr, "Unable to realloc: %s\n", strerror(errno));
+            return false;
+        }
+        list->data     = data;
+        list->capacity = capacity;
+    }
+
+    list->data[list->size++] = *sample;
+    return true;
+}
+
+/**
+ * Write samples as time series, with CPU utilization over each interval.
+ * @param   stream      Stream to write to.
+ * @param   format      "csv" or "json".
+ * @param   list        List of samples.
+ **/
+void    samples_write(FILE *stream, const char *format, const SampleList *list) {
+    bool json = streq(format, "json");
+
+    if (json) {
+        fputs("{\"samples\": [\n", stream);
+    } else {
+        fputs("run,time,processes,threads,cpu_percent,cpu,rss_kb,rchar,wchar,read_bytes,write_bytes\n", stream);
+    }
+
+    for (size_t i = 0; i < list->size; i++) {
+        const Sample *s = &list->data[i];
+        const Sample *p = i > 0 && list->data[i - 1].run == s->run ? &list->data[i - 1] : NULL;
+
+        // Utilization since previous sample of same run (or since start)
+        double period  = p ? s->time - p->time : s->time;
+        double percent = period > 0 ? 100 * (s->cpu - (p ? p->cpu : 0)) / period : 0;
+        if (percent < 0) percent = 0;       // Busy process left the group
+
+        if (json) {
+            fprintf(stream, "  {\"run\": %d, \"time\": %.3lf, \"processes\": %d, \"threads\": %d, \"cpu_percent\": %.1lf, \"cpu\": %.2lf, "
+                "\"rss_kb\": %ld, \"rchar\": %lu, \"wchar\": %lu, \"read_bytes\": %lu, \"write_bytes\": %lu}%s\n",
+                s->run, s->time, s->processes, s->threads, percent, s->cpu,
+                s->rss, s->rchar, s->wchar, s->read_bytes, s->write_bytes, i + 1 < list->size ? "," : "");
+        } else {
+            fprintf(stream, "%d,%.3lf,%d,%d,%.1lf,%.2lf,%ld,%lu,%lu,%lu,%lu\n",
+                s->run, s->time, s->processes, s->threads, percent, s->cpu,
+                s->rss, s->rchar, s->wchar, s->read_bytes, s->write_bytes);
+        }
+    }
+
+    if (json) fputs("]}\n", stream);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,725 @@
+/* scan.c: Concurrent port scanning engine */
+
+#include "nmapit.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+/* Constants */
+
+#define EVENTS_MAX          64          /* Completions handled per ring_wait */
+#define FD_RESERVED         32          /* Descriptors kept free for stdio, epoll, timers */
+#define BURST_INTERVAL      20          /* Tokens a bucket may hold (ms of rate) */
+#define SPIKE_THRESHOLD     0.25        /* Timeout ratio increase treated as congestion */
+#define BANNER_MAX          256         /* Bytes of banner read */
+#define THOUSAND            1000
+
+/* Probe Phases */
+
+enum {
+    PHASE_CONNECT,      /* Waiting for connect to complete */
+    PHASE_BANNER,       /* Connected, waiting for server to send banner */
+    PHASE_SEND,         /* Sending protocol probe */
+    PHASE_PROBE,        /* Sent protocol probe, waiting for response */
+};
+
+/* Structures */
+
+typedef struct {
+    uint32_t    mask;       // Size of permuted domain minus one (power of two)
+    uint32_t    a;          // Odd multiplier
+    uint32_t    b;          // Offset
+    uint32_t    count;      // Number of ports in range
+    int         start;      // First port of range
+} Permutation;
+
+typedef struct {
+    Target             target;  // Host being probed
+    const Permutation *order;   // Order in which ports are probed
+    int                next;    // Index of next port to probe
+    int                last;    // Index of last port to probe
+    size_t      pending;    // Number of probes still in flight
+    bool        issuing;    // Whether a worker is still issuing its ports
+} Job;
+
+typedef struct {
+    int         fd;         // Socket file descriptor (-1 if unused)
+    int         port;       // Port being probed
+    Job        *job;        // Job port belongs to
+    int         phase;      // Current phase (PHASE_CONNECT, ...)
+    bool        expired;    // Whether deadline passed and operation was cancelled
+    uint64_t    started;    // Time connect was issued (us)
+    uint64_t    rtt;        // Time from connect to result (us)
+    uint64_t    deadline;   // Time probe expires (us)
+    size_t      index;      // Position in deadline heap
+    char        banner[BANNER_MAX]; // Banner or probe response
+    char        request[BUFSIZ];    // Protocol probe being sent
+} Probe;
+
+typedef struct {
+    Probe     **data;       // Pending probes ordered by deadline
+    size_t      size;       // Number of pending probes
+} Heap;
+
+typedef struct {
+    double      srtt;       // Smoothed round-trip time (us)
+    double      rttvar;     // Round-trip time variation (us)
+    bool        sampled;    // Whether any round-trip has been observed
+} Estimator;
+
+typedef struct {
+    double      rate;       // Tokens added per microsecond (0 is unlimited)
+    double      tokens;     // Tokens currently available
+    double      burst;      // Maximum tokens held
+    uint64_t    updated;    // Time of last refill (us)
+} Bucket;
+
+typedef struct {
+    double      window;     // Number of probes allowed in flight
+    double      limit;      // Maximum window
+    double      fast;       // Short-term timeout ratio
+    double      slow;       // Long-term timeout ratio
+    uint64_t    hold;       // No further decrease before this time (us)
+} Congestion;
+
+typedef struct {
+    TargetStream   *targets;    // Shared stream of targets
+    Target          target;     // Target currently being split into jobs
+    Permutation     order;      // Order in which ports are handed out
+    bool            active;     // Whether target has ports left
+    int             next;       // Index of next port of target to hand out
+    Options        *options;    // Scan options
+    pthread_mutex_t lock;       // Serializes access to queue
+} WorkQueue;
+
+typedef struct {
+    WorkQueue  *queue;      // Shared work queue
+    Options    *options;    // Scan options
+    pthread_t   thread;     // Worker thread
+    size_t      inflight;   // Maximum concurrent probes
+    double      rate;       // Connections per second (0 is unlimited)
+    bool        failed;     // Whether worker stopped on an error
+} Worker;
+
+/* Time Functions */
+
+/**
+ * Return current monotonic time.
+ * @return  Microseconds since an arbitrary fixed point
+ **/
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * THOUSAND * THOUSAND + ts.tv_nsec / THOUSAND;
+}
+
+/* Deadline Heap Functions */
+
+/**
+ * Swap two entries in heap and update their indices.
+ * @param   h           Pointer to heap
+ * @param   a           Index of first entry
+ * @param   b           Index of second entry
+ **/
+static void heap_swap(Heap *h, size_t a, size_t b) {
+    Probe *t   = h->data[a];
+    h->data[a] = h->data[b];
+    h->data[b] = t;
+    h->data[a]->index = a;
+    h->data[b]->index = b;
+}
+
+/**
+ * Restore heap order by moving entry at index up or down.
+ * @param   h           Pointer to heap
+ * @param   i           Index of entry that may be out of place
+ **/
+static void heap_fix(Heap *h, size_t i) {
+    // Sift up while earlier than parent
+    while (i > 0 && h->data[i]->deadline < h->data[(i - 1) / 2]->deadline) {
+        heap_swap(h, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+
+    // Sift down while later than either child
+    for (;;) {
+        size_t l = 2*i + 1, r = 2*i + 2, m = i;
+        if (l < h->size && h->data[l]->deadline < h->data[m]->deadline) m = l;
+        if (r < h->size && h->data[r]->deadline < h->data[m]->deadline) m = r;
+        if (m == i) break;
+        heap_swap(h, i, m);
+        i = m;
+    }
+}
+
+/**
+ * Insert probe into heap.
+ * @param   h           Pointer to heap
+ * @param   p           Probe to insert
+ **/
+static void heap_push(Heap *h, Probe *p) {
+    p->index = h->size;
+    h->data[h->size++] = p;
+    heap_fix(h, p->index);
+}
+
+/**
+ * Remove probe from heap.
+ * @param   h           Pointer to heap
+ * @param   p           Probe to remove
+ **/
+static void heap_remove(Heap *h, Probe *p) {
+    size_t i = p->index;
+    if (i != --h->size) {
+        heap_swap(h, i, h->size);
+        heap_fix(h, i);
+    }
+}
+
+/* Timeout Functions */
+
+/**
+ * Return current connection timeout.
+ * @param   e           Pointer to round-trip estimator
+ * @param   options     Scan options
+ * @return  Timeout in microseconds
+ **/
+static uint64_t timeout_us(Estimator *e, Options *options) {
+    uint64_t limit = (uint64_t)options->timeout * THOUSAND;
+    if (!options->adaptive || !e->sampled) return limit;
+
+    // RFC 6298: RTO = SRTT + 4 * RTTVAR, clamped to [minimum, -T]
+    uint64_t rto = e->srtt + 4 * e->rttvar;
+    if (rto < TIMEOUT_MINIMUM * THOUSAND) rto = TIMEOUT_MINIMUM * THOUSAND;
+    return rto < limit ? rto : limit;
+}
+
+/**
+ * Record round-trip sample in estimator.
+ * @param   e           Pointer to round-trip estimator
+ * @param   rtt         Round-trip time (us)
+ **/
+static void timeout_sample(Estimator *e, uint64_t rtt) {
+    if (!e->sampled) {
+        e->srtt    = rtt;
+        e->rttvar  = rtt / 2.0;
+        e->sampled = true;
+    } else {
+        double delta = e->srtt > rtt ? e->srtt - rtt : rtt - e->srtt;
+        e->rttvar = 0.75 * e->rttvar + 0.25 * delta;
+        e->srtt   = 0.875 * e->srtt + 0.125 * rtt;
+    }
+}
+
+/**
+ * Compute how long to wait for the earliest deadline in heap or wake up time.
+ * @param   h           Pointer to heap
+ * @param   wake        Time to wake up for rate limiting (0 if none)
+ * @param   now         Current time (us)
+ * @return  Microseconds to wait, or -1 if there is nothing to wait for
+ **/
+static int64_t timer_wait(Heap *h, uint64_t wake, uint64_t now) {
+    uint64_t deadline = wake;
+    if (h->size > 0 && (deadline == 0 || h->data[0]->deadline < deadline)) {
+        deadline = h->data[0]->deadline;
+    }
+    if (deadline == 0) return -1;
+    return deadline > now ? (int64_t)(deadline - now) : 0;
+}
+
+/* Rate Functions */
+
+/**
+ * Initialize token bucket.
+ * @param   b           Pointer to bucket
+ * @param   rate        Connections per second (0 is unlimited)
+ **/
+static void bucket_init(Bucket *b, double rate) {
+    b->rate    = rate / (THOUSAND * THOUSAND);
+    b->burst   = rate * BURST_INTERVAL / THOUSAND;
+    if (b->burst < 1) b->burst = 1;
+    b->tokens  = b->burst;
+    b->updated = now_us();
+}
+
+/**
+ * Take a token from bucket if one is available.
+ * @param   b           Pointer to bucket
+ * @param   now         Current time (us)
+ * @param   wake        Pointer to time next token is available (us)
+ * @return  true if a token was taken, otherwise false
+ **/
+static bool bucket_take(Bucket *b, uint64_t now, uint64_t *wake) {
+    if (b->rate <= 0) return true;
+
+    b->tokens += (now - b->updated) * b->rate;
+    b->updated = now;
+    if (b->tokens > b->burst) b->tokens = b->burst;
+
+    if (b->tokens >= 1) {
+        b->tokens -= 1;
+        return true;
+    }
+    *wake = now + (uint64_t)((1 - b->tokens) / b->rate) + 1;
+    return false;
+}
+
+/**
+ * Update congestion window with probe outcome (AIMD).
+ *
+ * The window grows by one probe per window of completions, and is halved
+ * (at most once per timeout) when the short-term timeout ratio spikes above
+ * its long-term baseline.  Hosts that never answer raise the baseline, so
+ * filtered targets alone do not collapse the window.
+ * @param   c           Pointer to congestion state
+ * @param   timeout     Whether probe timed out
+ * @param   now         Current time (us)
+ * @param   rto         Current timeout (us)
+ **/
+static void congestion_update(Congestion *c, bool timeout, uint64_t now, uint64_t rto) {
+    double x = timeout ? 1.0 : 0.0;
+    c->fast += (x - c->fast) / 8;
+    c->slow += (x - c->slow) / 64;
+
+    if (c->fast > c->slow + SPIKE_THRESHOLD) {
+        if (timeout && now >= c->hold) {
+            c->window = c->window / 2 < 1 ? 1 : c->window / 2;
+            c->hold   = now + rto;
+        }
+        return;
+    }
+
+    c->window += 1 / c->window;
+    if (c->window > c->limit) c->window = c->limit;
+}
+
+/* Permutation Functions */
+
+/**
+ * Initialize random permutation of port range.
+ * @param   order       Pointer to permutation
+ * @param   start       First port of range
+ * @param   end         Last port of range
+ * @param   randomize   Whether to shuffle (otherwise identity)
+ **/
+static void permutation_init(Permutation *order, int start, int end, bool randomize) {
+    order->start = start;
+    order->count = end - start + 1;
+    order->mask  = 1;
+    while (order->mask < order->count) order->mask <<= 1;
+    order->mask -= 1;
+
+    uint32_t seed[2] = {0, 0};
+    if (randomize && getrandom(seed, sizeof(seed), 0) != sizeof(seed)) {
+        seed[0] = now_us();
+        seed[1] = getpid();
+    }
+    order->a = randomize ? (seed[0] | 1) : 1;
+    order->b = randomize ? seed[1] : 0;
+}
+
+/**
+ * Map index to port.
+ *
+ * An odd multiplier and an offset modulo a power of two form a bijection;
+ * values outside of the range are skipped by re-applying the map (cycle
+ * walking), which keeps it a bijection on the range itself.
+ * @param   order       Pointer to permutation
+ * @param   index       Index in [0, count)
+ * @return  Port number
+ **/
+static int permutation_port(const Permutation *order, uint32_t index) {
+    uint32_t x = index;
+    do {
+        x = (x * order->a + order->b) & order->mask;
+    } while (x >= order->count);
+    return order->start + x;
+}
+
+/* Work Queue Functions */
+
+/**
+ * Hand out next batch of ports of the current target.
+ * @param   q           Pointer to work queue
+ * @return  Newly allocated job (must be freed), or NULL when exhausted
+ **/
+static Job *work_next(WorkQueue *q) {
+    Job *job = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (!q->active && target_stream_next(q->targets, &q->target)) {
+        q->active = true;
+        q->next   = 0;
+    }
+
+    if (q->active && (job = calloc(1, sizeof(Job)))) {
+        job->target  = q->target;
+        job->order   = &q->order;
+        job->issuing = true;
+        job->next    = q->next;
+        job->last    = q->next + JOB_PORTS - 1;
+        if (job->last >= (int)q->order.count - 1) {
+            job->last = q->order.count - 1;
+            q->active = false;
+        }
+        q->next = job->last + 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return job;
+}
+
+/**
+ * Free job once all of its ports have been issued and completed.
+ * @param   job         Job to release
+ **/
+static void job_release(Job *job) {
+    if (!job->issuing && job->pending == 0) free(job);
+}
+
+/* Probe Functions */
+
+/**
+ * Report probe result and release its socket.
+ * @param   p           Probe to finish
+ * @param   state       Port state (PORT_OPEN, PORT_CLOSED, PORT_FILTERED)
+ * @param   banner      NUL-terminated banner received (may be NULL)
+ * @param   options     Scan options
+ **/
+static void probe_finish(Probe *p, int state, char *banner, Options *options) {
+    if (options->report) {
+        // Match the whole banner before it is cut down to its first line
+        const char *service = banner ? service_match(banner) : NULL;
+        Result result = {
+            .host    = p->job->target.name,
+            .port    = p->port,
+            .state   = state,
+            .rtt     = p->rtt,
+            .service = service,
+            .banner  = banner ? service_first_line(banner) : NULL,
+        };
+        options->report(&result, options->arg);
+    }
+
+    if (p->fd >= 0) socket_close(p->fd);
+    p->fd = -1;
+    p->job->pending--;
+    job_release(p->job);
+}
+
+/**
+ * Send protocol probe (HTTP HEAD request) to connected port.
+ * @param   p           Probe to send on
+ * @param   ring        I/O ring
+ * @param   now         Current time (us)
+ * @param   options     Scan options
+ * @return  true if send was queued, otherwise false
+ **/
+static bool probe_send(Probe *p, Ring *ring, uint64_t now, Options *options) {
+    int n = snprintf(p->request, sizeof(p->request), "HEAD / HTTP/1.0\r\nHost: %s\r\n\r\n", p->job->target.name);
+    if (!ring_send(ring, p->fd, p->request, n, p)) return false;
+
+    p->phase    = PHASE_SEND;
+    p->deadline = now + (uint64_t)options->banner_timeout * THOUSAND / 2;
+    return true;
+}
+
+/**
+ * Switch connected probe to waiting for a banner.
+ *
+ * Ports where the client usually speaks first are probed right away;
+ * elsewhere the server gets half of the banner timeout to greet us before a
+ * probe is sent.
+ * @param   p           Probe to switch
+ * @param   ring        I/O ring
+ * @param   now         Current time (us)
+ * @param   options     Scan options
+ * @return  true if an operation was queued, otherwise false
+ **/
+static bool probe_listen(Probe *p, Ring *ring, uint64_t now, Options *options) {
+    if (service_probe_first(p->port)) return probe_send(p, ring, now, options);
+    if (!ring_recv(ring, p->fd, p->banner, sizeof(p->banner) - 1, p)) return false;
+
+    p->phase    = PHASE_BANNER;
+    p->deadline = now + (uint64_t)options->banner_timeout * THOUSAND / 2;
+    return true;
+}
+
+/**
+ * Begin non-blocking connection attempt to next port of job.
+ * @param   p           Probe to initialize
+ * @param   ring        I/O ring
+ * @param   job         Job to take port from
+ * @return  true if connect was queued, false if out of resources
+ **/
+static bool probe_start(Probe *p, Ring *ring, Job *job) {
+    // Copy address and set port
+    Address target = job->target.address;
+    p->job     = job;
+    p->phase   = PHASE_CONNECT;
+    p->expired = false;
+    p->port    = permutation_port(job->order, job->next);
+    address_set_port(&target, p->port);
+
+    // Queue connect on raw non-blocking socket (reset on close to avoid
+    // leaving scanned ports in TIME_WAIT)
+    p->started = now_us();
+    if ((p->fd = socket_open(target.family, SOCKET_NONBLOCK | SOCKET_CLOEXEC | SOCKET_LINGER0)) < 0) {
+        return false;
+    }
+    if (!ring_connect(ring, p->fd, &target, p)) {
+        socket_close(p->fd);
+        p->fd = -1;
+        return false;
+    }
+
+    job->next++;
+    job->pending++;
+    return true;
+}
+
+/* Worker Functions */
+
+/**
+ * Run event loop of one worker until the work queue is exhausted.
+ * @param   arg         Pointer to worker structure
+ * @return  NULL
+ **/
+static void *worker_run(void *arg) {
+    Worker  *w       = arg;
+    Options *options = w->options;
+
+    // Setup I/O ring (io_uring or epoll)
+    Ring *ring = ring_create(2 * w->inflight, options->uring ? RING_URING : RING_EPOLL);
+    if (ring == NULL) {
+        w->failed = true;
+        return NULL;
+    }
+
+    Probe     *probes = calloc(w->inflight, sizeof(Probe));
+    Probe    **idle   = calloc(w->inflight, sizeof(Probe *));
+    Heap       heap   = {.data = calloc(w->inflight, sizeof(Probe *)), .size = 0};
+    size_t     nidle  = w->inflight;
+    Estimator  estimator  = {.sampled = false};
+    Congestion congestion = {.window = w->inflight, .limit = w->inflight};
+    Bucket     bucket;
+    Job       *job = NULL;
+    bool       drained = false;
+
+    if (probes == NULL || idle == NULL || heap.data == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        drained = w->failed = true;
+        nidle = w->inflight;
+    } else {
+        for (size_t i = 0; i < nidle; i++) {
+            probes[i].fd = -1;
+            idle[i] = &probes[i];
+        }
+    }
+    bucket_init(&bucket, w->rate);
+
+    // Keep connections pending until queue is drained and all probes finish
+    while (!drained || nidle < w->inflight) {
+        uint64_t wake = 0;
+        while (nidle > 0 && !drained && w->inflight - nidle < (size_t)congestion.window) {
+            if (job == NULL && (job = work_next(w->queue)) == NULL) {
+                drained = true;
+                break;
+            }
+            if (!bucket_take(&bucket, now_us(), &wake)) break;
+
+            Probe *p = idle[--nidle];
+            if (!probe_start(p, ring, job)) {
+                // Out of descriptors: retry once pending probes finish
+                idle[nidle++] = p;
+                if (nidle == w->inflight) w->failed = drained = true;
+                break;
+            }
+            p->deadline = p->started + timeout_us(&estimator, options);
+            heap_push(&heap, p);
+
+            if (job->next > job->last) {
+                job->issuing = false;
+                job_release(job);
+                job = NULL;
+            }
+        }
+
+        if (nidle == w->inflight && wake == 0) continue;
+
+        Completion completions[EVENTS_MAX];
+        int n = ring_wait(ring, completions, EVENTS_MAX, timer_wait(&heap, wake, now_us()));
+        if (n < 0) {
+            fprintf(stderr, "Unable to wait for I/O: %s\n", strerror(errno));
+            w->failed = true;
+            break;
+        }
+
+        uint64_t now = now_us();
+        for (int i = 0; i < n; i++) {
+            Probe *p       = completions[i].data;
+            int    result  = completions[i].result;
+            bool   expired = p->expired;
+
+            if (!expired) heap_remove(&heap, p);
+            p->expired = false;
+
+            switch (p->phase) {
+                case PHASE_CONNECT:
+                    p->rtt = now - p->started;
+                    if (result == -ECANCELED || (expired && result != 0)) {
+                        // No answer to connect before deadline: filtered
+                        congestion_update(&congestion, true, now, timeout_us(&estimator, options));
+                        probe_finish(p, PORT_FILTERED, NULL, options);
+                        break;
+                    }
+
+                    // Connection completed: open if no error, closed if refused
+                    if (result == 0 || result == -ECONNREFUSED) timeout_sample(&estimator, p->rtt);
+                    congestion_update(&congestion, false, now, timeout_us(&estimator, options));
+                    if (result == 0 && options->banners && probe_listen(p, ring, now, options)) {
+                        heap_push(&heap, p);
+                        continue;
+                    }
+                    probe_finish(p, result == 0 ? PORT_OPEN : PORT_CLOSED, NULL, options);
+                    break;
+
+                case PHASE_BANNER:
+                    // Silent server: try protocol probe
+                    if (result <= 0 && expired && probe_send(p, ring, now, options)) {
+                        heap_push(&heap, p);
+                        continue;
+                    }
+                    // Fall through
+
+                case PHASE_PROBE:
+                    if (result > 0) {
+                        p->banner[result] = 0;
+                        probe_finish(p, PORT_OPEN, p->banner, options);
+                    } else {
+                        probe_finish(p, PORT_OPEN, NULL, options);
+                    }
+                    break;
+
+                case PHASE_SEND:
+                    // Probe sent: wait for response for the rest of the deadline
+                    if (result >= 0 && !expired &&
+                        ring_recv(ring, p->fd, p->banner, sizeof(p->banner) - 1, p)) {
+                        p->phase = PHASE_PROBE;
+                        heap_push(&heap, p);
+                        continue;
+                    }
+                    probe_finish(p, PORT_OPEN, NULL, options);
+                    break;
+            }
+            idle[nidle++] = p;
+        }
+
+        // Cancel operations of probes whose deadline has passed; they
+        // complete (with -ECANCELED) on a later wait
+        while (heap.size > 0 && heap.data[0]->deadline <= now) {
+            Probe *q = heap.data[0];
+            heap_remove(&heap, q);
+            q->expired = true;
+            if (!ring_cancel(ring, q)) {
+                fprintf(stderr, "Unable to cancel I/O: %s\n", strerror(errno));
+                w->failed = true;
+            }
+        }
+    }
+
+    if (job) {
+        job->issuing = false;
+        job_release(job);
+    }
+    free(heap.data);
+    free(idle);
+    free(probes);
+    ring_delete(ring);
+    return NULL;
+}
+
+/**
+ * Scan port range of every target in stream using worker threads.
+ * @param   targets     Stream of targets to scan
+ * @param   options     Scan options (port range, timeout, threads, report)
+ * @return  true if all workers completed, otherwise false
+ **/
+bool scan_targets(TargetStream *targets, Options *options) {
+    WorkQueue queue = {
+        .targets = targets,
+        .active  = false,
+        .options = options,
+        .lock    = PTHREAD_MUTEX_INITIALIZER,
+    };
+    permutation_init(&queue.order, options->start, options->end, options->randomize);
+    if (options->banners && !service_init()) return false;
+
+    // A worker needs at least one probe of the in-flight budget
+    int nworkers = options->threads > 0 ? options->threads : 1;
+    if (options->inflight > 0 && nworkers > options->inflight) nworkers = options->inflight;
+    Worker *workers = calloc(nworkers, sizeof(Worker));
+    if (workers == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Share in-flight and descriptor budgets between workers, spreading the
+    // remainder so the shares add up to the requested total (raising soft
+    // limit if allowed)
+    size_t inflight  = INFLIGHT_MAX;
+    int    remainder = 0;
+    if (options->inflight > 0) {
+        inflight  = options->inflight / nworkers;
+        remainder = options->inflight % nworkers;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+            getrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)nworkers * inflight + remainder + FD_RESERVED) {
+            inflight  = rl.rlim_cur > FD_RESERVED + nworkers ? (rl.rlim_cur - FD_RESERVED) / nworkers : 1;
+            remainder = 0;
+        }
+    }
+
+    // Start workers, each running its own event loop
+    int started = 0;
+    for (; started < nworkers; started++) {
+        Worker *w   = &workers[started];
+        w->queue    = &queue;
+        w->options  = options;
+        w->inflight = inflight + (started < remainder);
+        w->rate     = (double)options->rate / nworkers;
+
+        int status;
+        if ((status = pthread_create(&w->thread, NULL, worker_run, w)) != 0) {
+            fprintf(stderr, "Unable to pthread_create: %s\n", strerror(status));
+            break;
+        }
+    }
+
+    // Wait for workers
+    bool success = started > 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].failed) success = false;
+    }
+
+    free(workers);
+    if (options->banners) service_free();
+    return success;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,519 @@
+/* scanbench.c: Benchmark nmapit's scan engine against a loopback listener farm */
+
+#include "nmapit.h"
+#include "histogram.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* Constants */
+
+#define BENCH_HOST          "127.0.0.1"
+#define BENCH_START         20000       /* Default first port of farm */
+#define BENCH_END           23999       /* Default last port of farm */
+#define BENCH_OPEN          64          /* Default listeners that accept */
+#define BENCH_FILTERED      16          /* Default listeners that drop SYNs */
+#define BENCH_DELAYED       16          /* Default listeners that delay their banner */
+#define BENCH_DELAY         100         /* Default banner delay (ms) */
+#define BENCH_RUNS          3           /* Default number of scans */
+#define BENCH_TIMEOUT       200         /* Default connection timeout (ms) */
+#define BENCH_BANNER        "220 scanbench delayed FTP ready\r\n"
+
+/* Port Kinds */
+
+enum {
+    KIND_CLOSED,        // Nothing bound: connect is refused
+    KIND_OPEN,          // Listener that accepts and closes immediately
+    KIND_FILTERED,      // Listener with full accept queue: SYNs are dropped
+    KIND_DELAYED,       // Listener that accepts but holds its banner
+    KIND_FOREIGN,       // Port already in use by another process (not scored)
+};
+
+/* Structures */
+
+typedef struct {
+    int         fd;         // Accepted connection
+    uint64_t    deadline;   // When to send banner and close (us)
+} Held;
+
+typedef struct {
+    int         start;      // First port of farm
+    int        *kinds;      // Kind of each port in farm
+    int        *fds;        // Listening sockets (-1 for closed ports)
+    int        *fillers;    // Connections filling accept queues of filtered ports
+    size_t      nports;     // Number of ports in farm
+    int         delay;      // Banner delay (ms)
+    int         epoll;      // Events on open and delayed listeners
+    int         stop;       // Eventfd that stops farm thread
+    Held       *held;       // Connections waiting for their banner
+    size_t      nheld;      // Number of held connections
+    size_t      capacity;   // Capacity of held array
+    pthread_t   thread;     // Thread accepting connections
+} Farm;
+
+typedef struct {
+    Farm           *farm;           // Farm being scanned
+    Histogram       latency[3];     // Round-trip time per reported state (us)
+    size_t          reported;       // Number of ports reported
+    size_t          correct;        // Ports reported with expected state
+    size_t          scored;         // Ports reported that are not foreign
+    size_t          banners;        // Delayed ports whose banner was read
+    pthread_mutex_t lock;           // Serializes updates from workers
+} Tally;
+
+/* Utility Functions */
+
+/**
+ * Display usage message and exit.
+ * @param   status      Exit status
+ **/
+void    usage(int status) {
+    fprintf(stderr, "Usage: scanbench [-p START-END] [-o N] [-f N] [-d N] [-D MS] [-n RUNS] [-T MS] [-a] [-t THREADS] [-c N] [-r RATE] [-s] [-b] [-u]\n");
+    fprintf(stderr, "Farm:\n");
+    fprintf(stderr, "    -p START-END    Range of loopback ports in farm (default is %d-%d)\n", BENCH_START, BENCH_END);
+    fprintf(stderr, "    -o N            Number of open ports (default is %d)\n", BENCH_OPEN);
+    fprintf(stderr, "    -f N            Number of blackholed ports (default is %d)\n", BENCH_FILTERED);
+    fprintf(stderr, "    -d N            Number of open ports with a delayed banner (default is %d)\n", BENCH_DELAYED);
+    fprintf(stderr, "    -D MS           Banner delay in milliseconds (default is %d)\n", BENCH_DELAY);
+    fprintf(stderr, "    -n RUNS         Number of scans to run (default is %d)\n", BENCH_RUNS);
+    fprintf(stderr, "Scanner:\n");
+    fprintf(stderr, "    -T MS           Connection timeout in milliseconds (default is %d)\n", BENCH_TIMEOUT);
+    fprintf(stderr, "    -a              Adapt timeout from observed round-trip times\n");
+    fprintf(stderr, "    -t THREADS      Number of worker threads (default is number of CPUs)\n");
+    fprintf(stderr, "    -c N            Maximum connections in flight (default is %d per thread)\n", INFLIGHT_MAX);
+    fprintf(stderr, "    -r RATE         Maximum connections per second (default is unlimited)\n");
+    fprintf(stderr, "    -s              Scan ports sequentially instead of in random order\n");
+    fprintf(stderr, "    -b              Grab banners and identify services on open ports\n");
+    fprintf(stderr, "    -u              Use io_uring for socket I/O when available\n");
+    exit(status);
+}
+
+/**
+ * Return monotonic time in microseconds.
+ **/
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Parse non-negative integer option argument.
+ * @param   s           String to parse
+ * @param   value       Pointer to integer to store
+ * @return  true if string is a non-negative integer, otherwise false
+ **/
+static bool parse_count(const char *s, int *value) {
+    char *end;
+    long  n = strtol(s, &end, 10);
+    if (end == s || *end || n < 0 || n > PORT_MAX) return false;
+    *value = n;
+    return true;
+}
+
+/* Farm Functions */
+
+/**
+ * Create listening socket bound to loopback port.
+ * @param   port        Port to bind
+ * @param   backlog     Listen backlog
+ * @return  Listening socket, or -1 if port is in use or on error
+ **/
+static int farm_listen(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, BENCH_HOST, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Fill accept queue of backlog 0 listener so the kernel drops further SYNs,
+ * making the port look filtered without any firewall rules.
+ * @param   port        Port of listener
+ * @return  Connected socket occupying the accept queue, or -1 on error
+ **/
+static int farm_blackhole(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    inet_pton(AF_INET, BENCH_HOST, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send banner on held connections whose delay has passed and close them.
+ * @param   farm        Pointer to farm
+ * @param   now         Current time (us)
+ * @return  Time until next held connection is due (ms), or -1 if none
+ **/
+static int farm_release(Farm *farm, uint64_t now) {
+    int wait = -1;
+    for (size_t i = 0; i < farm->nheld; ) {
+        Held *h = &farm->held[i];
+        if (h->deadline <= now) {
+            if (write(h->fd, BENCH_BANNER, strlen(BENCH_BANNER)) < 0) {
+                // Scanner gave up on banner before delay passed
+            }
+            close(h->fd);
+            farm->held[i] = farm->held[--farm->nheld];
+            continue;
+        }
+
+        int due = (h->deadline - now + 999) / 1000;
+        if (wait < 0 || due < wait) wait = due;
+        i++;
+    }
+    return wait;
+}
+
+/**
+ * Accept connections on open and delayed listeners until stopped.
+ * @param   arg         Pointer to farm
+ * @return  NULL
+ **/
+static void *farm_run(void *arg) {
+    Farm *farm = arg;
+    struct epoll_event events[64];
+
+    while (true) {
+        int wait = farm_release(farm, now_us());
+        int n    = epoll_wait(farm->epoll, events, 64, wait);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "Unable to epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == UINT64_MAX) return NULL;
+
+            size_t index = events[i].data.u64;
+            int    fd;
+            while ((fd = accept(farm->fds[index], NULL, NULL)) >= 0) {
+                if (farm->kinds[index] != KIND_DELAYED) {
+                    close(fd);
+                    continue;
+                }
+
+                if (farm->nheld == farm->capacity) {
+                    farm->capacity = farm->capacity ? 2 * farm->capacity : 64;
+                    farm->held     = realloc(farm->held, farm->capacity * sizeof(Held));
+                }
+                farm->held[farm->nheld++] = (Held){fd, now_us() + (uint64_t)farm->delay * 1000};
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Lay out ports of farm and start listeners.
+ *
+ * Ports are assigned kinds in a fixed pseudo-random order so results are
+ * comparable between runs.  Ports that another process already holds are
+ * marked foreign and left out of the layout and the accuracy score.
+ * @param   farm        Pointer to farm to initialize
+ * @param   start       First port
+ * @param   end         Last port
+ * @param   counts      Number of ports of each kind (indexed by kind)
+ * @param   delay       Banner delay (ms)
+ * @return  true if farm started, otherwise false
+ **/
+static bool farm_start(Farm *farm, int start, int end, const int *counts, int delay) {
+    memset(farm, 0, sizeof(Farm));
+    farm->start   = start;
+    farm->nports  = end - start + 1;
+    farm->delay   = delay;
+    farm->kinds   = calloc(farm->nports, sizeof(int));
+    farm->fds     = malloc(farm->nports * sizeof(int));
+    farm->fillers = malloc(farm->nports * sizeof(int));
+    farm->epoll   = epoll_create1(EPOLL_CLOEXEC);
+    farm->stop    = eventfd(0, EFD_CLOEXEC);
+    if (farm->epoll < 0 || farm->stop < 0) {
+        fprintf(stderr, "Unable to create farm: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Find ports that are free and shuffle them
+    size_t *order = malloc(farm->nports * sizeof(size_t));
+    size_t  nfree = 0;
+    for (size_t i = 0; i < farm->nports; i++) {
+        farm->fds[i] = farm->fillers[i] = -1;
+        int fd = farm_listen(start + i, 1);
+        if (fd < 0) {
+            farm->kinds[i] = KIND_FOREIGN;
+            continue;
+        }
+        close(fd);
+        order[nfree++] = i;
+    }
+
+    uint32_t seed = 2024;
+    for (size_t i = nfree; i > 1; i--) {
+        seed = seed * 1103515245 + 12345;
+        size_t j = (seed >> 8) % i, t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j]     = t;
+    }
+
+    size_t needed = (size_t)counts[KIND_OPEN] + counts[KIND_FILTERED] + counts[KIND_DELAYED];
+    if (needed > nfree) {
+        fprintf(stderr, "Farm needs %zu listeners but only %zu ports are free\n", needed, nfree);
+        free(order);
+        return false;
+    }
+
+    // Start listeners
+    size_t next = 0;
+    for (int kind = KIND_OPEN; kind <= KIND_DELAYED; kind++) {
+        for (int k = 0; k < counts[kind]; k++) {
+            size_t index = order[next++];
+            int    port  = start + index;
+
+            farm->kinds[index] = kind;
+            farm->fds[index]   = farm_listen(port, kind == KIND_FILTERED ? 0 : SOMAXCONN);
+            if (farm->fds[index] < 0) {
+                fprintf(stderr, "Unable to listen on %d: %s\n", port, strerror(errno));
+                free(order);
+                return false;
+            }
+
+            if (kind == KIND_FILTERED) {
+                farm->fillers[index] = farm_blackhole(port);
+                if (farm->fillers[index] < 0) {
+                    fprintf(stderr, "Unable to blackhole %d: %s\n", port, strerror(errno));
+                    free(order);
+                    return false;
+                }
+                continue;
+            }
+
+            struct epoll_event event = {.events = EPOLLIN, .data.u64 = index};
+            epoll_ctl(farm->epoll, EPOLL_CTL_ADD, farm->fds[index], &event);
+        }
+    }
+    free(order);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = UINT64_MAX};
+    epoll_ctl(farm->epoll, EPOLL_CTL_ADD, farm->stop, &event);
+
+    if ((errno = pthread_create(&farm->thread, NULL, farm_run, farm)) != 0) {
+        fprintf(stderr, "Unable to pthread_create: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stop farm thread and close all listeners.
+ * @param   farm        Pointer to farm
+ **/
+static void farm_stop(Farm *farm) {
+    uint64_t one = 1;
+    if (write(farm->stop, &one, sizeof(one)) == sizeof(one)) pthread_join(farm->thread, NULL);
+
+    for (size_t i = 0; i < farm->nheld; i++) close(farm->held[i].fd);
+    for (size_t i = 0; i < farm->nports; i++) {
+        if (farm->fds[i] >= 0)     close(farm->fds[i]);
+        if (farm->fillers[i] >= 0) close(farm->fillers[i]);
+    }
+    close(farm->epoll);
+    close(farm->stop);
+    free(farm->held);
+    free(farm->fillers);
+    free(farm->fds);
+    free(farm->kinds);
+}
+
+/* Tally Functions */
+
+/**
+ * Record port result reported by scan workers.
+ * @param   result      Result of probing port
+ * @param   arg         Pointer to tally
+ **/
+static void tally_port(const Result *result, void *arg) {
+    static const int Expected[] = {
+        [KIND_CLOSED]   = PORT_CLOSED,
+        [KIND_OPEN]     = PORT_OPEN,
+        [KIND_FILTERED] = PORT_FILTERED,
+        [KIND_DELAYED]  = PORT_OPEN,
+    };
+
+    Tally *tally = arg;
+    int    kind  = tally->farm->kinds[result->port - tally->farm->start];
+
+    pthread_mutex_lock(&tally->lock);
+    histogram_record(&tally->latency[result->state], result->rtt);
+    tally->reported++;
+    if (kind != KIND_FOREIGN) {
+        tally->scored++;
+        if (Expected[kind] == result->state) tally->correct++;
+        if (kind == KIND_DELAYED && result->banner) tally->banners++;
+    }
+    pthread_mutex_unlock(&tally->lock);
+}
+
+/**
+ * Print latency percentiles of each port state.
+ * @param   latency     Histograms indexed by port state
+ **/
+static void tally_print(const Histogram *latency) {
+    static const char *States[] = {"open", "closed", "filtered"};
+
+    printf("%-10s %8s %10s %10s %10s %10s %10s\n", "state", "ports", "min(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    for (int state = PORT_OPEN; state <= PORT_FILTERED; state++) {
+        const Histogram *h = &latency[state];
+        if (h->total == 0) continue;
+        printf("%-10s %8lu %10lu %10lu %10lu %10lu %10lu\n", States[state], h->total,
+            h->min,
+            histogram_percentile(h, 50),
+            histogram_percentile(h, 90),
+            histogram_percentile(h, 99),
+            h->max);
+    }
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    int start  = BENCH_START;
+    int end    = BENCH_END;
+    int delay  = BENCH_DELAY;
+    int runs   = BENCH_RUNS;
+    int counts[] = {
+        [KIND_OPEN]     = BENCH_OPEN,
+        [KIND_FILTERED] = BENCH_FILTERED,
+        [KIND_DELAYED]  = BENCH_DELAYED,
+    };
+
+    Options options = {
+        .timeout        = BENCH_TIMEOUT,
+        .adaptive       = false,
+        .threads        = sysconf(_SC_NPROCESSORS_ONLN),
+        .inflight       = 0,
+        .rate           = 0,
+        .randomize      = true,
+        .banners        = false,
+        .uring          = false,
+        .banner_timeout = BANNER_TIMEOUT,
+        .report         = tally_port,
+    };
+
+    // Parse command-line arguments
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0) usage(0);
+        else if (strcmp(arg, "-p") == 0) {
+            if (i+1 >= argc || sscanf(argv[++i], "%d-%d", &start, &end) != 2) usage(1);
+            if (start <= 0 || end > PORT_MAX || start > end) usage(1);
+        } else if (strcmp(arg, "-o") == 0) {
+            if (i+1 >= argc || !parse_count(argv[++i], &counts[KIND_OPEN])) usage(1);
+        } else if (strcmp(arg, "-f") == 0) {
+            if (i+1 >= argc || !parse_count(argv[++i], &counts[KIND_FILTERED])) usage(1);
+        } else if (strcmp(arg, "-d") == 0) {
+            if (i+1 >= argc || !parse_count(argv[++i], &counts[KIND_DELAYED])) usage(1);
+        } else if (strcmp(arg, "-D") == 0) {
+            if (i+1 >= argc || !parse_count(argv[++i], &delay)) usage(1);
+        } else if (strcmp(arg, "-n") == 0) {
+            if (i+1 >= argc || !parse_count(argv[++i], &runs) || runs == 0) usage(1);
+        } else if (strcmp(arg, "-T") == 0) {
+            if (i+1 >= argc || (options.timeout = atoi(argv[++i])) <= 0) usage(1);
+        } else if (strcmp(arg, "-a") == 0) {
+            options.adaptive = true;
+        } else if (strcmp(arg, "-t") == 0) {
+            if (i+1 >= argc || (options.threads = atoi(argv[++i])) <= 0) usage(1);
+        } else if (strcmp(arg, "-c") == 0) {
+            if (i+1 >= argc || (options.inflight = atoi(argv[++i])) <= 0) usage(1);
+        } else if (strcmp(arg, "-r") == 0) {
+            if (i+1 >= argc || (options.rate = atoi(argv[++i])) <= 0) usage(1);
+        } else if (strcmp(arg, "-s") == 0) {
+            options.randomize = false;
+        } else if (strcmp(arg, "-b") == 0) {
+            options.banners = true;
+        } else if (strcmp(arg, "-u") == 0) {
+            options.uring = true;
+        } else {
+            usage(1);
+        }
+    }
+
+    if (options.threads < 1) options.threads = 1;
+    options.start = start;
+    options.end   = end;
+
+    // Start listener farm
+    Farm farm;
+    if (!farm_start(&farm, start, end, counts, delay)) return EXIT_FAILURE;
+
+    size_t foreign = 0;
+    for (size_t i = 0; i < farm.nports; i++) foreign += farm.kinds[i] == KIND_FOREIGN;
+
+    printf("farm: %s ports %d-%d, %d open, %d blackholed, %d delayed (%d ms), %zu in use elsewhere\n",
+        BENCH_HOST, start, end, counts[KIND_OPEN], counts[KIND_FILTERED], counts[KIND_DELAYED], delay, foreign);
+
+    // Scan farm repeatedly
+    Histogram totals[3];
+    for (int state = PORT_OPEN; state <= PORT_FILTERED; state++) histogram_init(&totals[state]);
+
+    Tally   tally   = {.farm = &farm, .lock = PTHREAD_MUTEX_INITIALIZER};
+    double  best    = 0;
+    double  rates   = 0;
+    bool    success = true;
+    char   *specs[] = {BENCH_HOST};
+    options.arg = &tally;
+
+    for (int run = 1; run <= runs; run++) {
+        for (int state = PORT_OPEN; state <= PORT_FILTERED; state++) histogram_init(&tally.latency[state]);
+        tally.reported = tally.correct = tally.scored = tally.banners = 0;
+
+        TargetStream targets;
+        target_stream_init(&targets, specs, 1, NULL);
+
+        uint64_t started = now_us();
+        if (!scan_targets(&targets, &options)) {
+            success = false;
+            break;
+        }
+        double elapsed = (now_us() - started) / 1e6;
+        double rate    = tally.reported / elapsed;
+
+        printf("run %d: %zu ports in %.3f s (%.0f ports/s), accuracy %.2f%% (%zu/%zu)",
+            run, tally.reported, elapsed, rate,
+            tally.scored ? 100.0 * tally.correct / tally.scored : 0, tally.correct, tally.scored);
+        if (options.banners) printf(", %zu/%d delayed banners", tally.banners, counts[KIND_DELAYED]);
+        printf("\n");
+
+        if (tally.reported != farm.nports || tally.correct != tally.scored) success = false;
+        if (rate > best) best = rate;
+        rates += rate;
+        for (int state = PORT_OPEN; state <= PORT_FILTERED; state++) histogram_merge(&totals[state], &tally.latency[state]);
+    }
+
+    // Summarize all runs
+    printf("throughput: mean %.0f ports/s, best %.0f ports/s\n", rates / runs, best);
+    tally_print(totals);
+
+    farm_stop(&farm);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
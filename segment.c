@@ -0,0 +1,180 @@
+/* segment.c: Parallel byte range downloads */
+
+#define _GNU_SOURCE
+
+#include "curlit.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Structures */
+
+typedef struct {
+    URL        *url;        // URL being downloaded
+    Pool       *pool;       // Pool used by this segment only
+    Sink        sink;       // File and position of next byte of segment
+    int64_t     end;        // Last byte of segment
+    Stats       stats;      // Transfer statistics of segment
+    bool        success;    // Whether segment was downloaded completely
+    bool        refused;    // Whether server answered without the range
+    pthread_t   thread;     // Thread downloading segment
+} Segment;
+
+/* Functions */
+
+/**
+ * Download remainder of segment with a Range request.
+ *
+ * Progress is kept in the segment's sink, so a failed segment can be
+ * retried from where it stopped.
+ * @param   s           Segment to download
+ * @return  true if the rest of the segment was written, otherwise false
+ **/
+static bool segment_fetch(Segment *s) {
+    if (s->sink.offset > s->end) return true;
+
+    char headers[BUFSIZ];
+    snprintf(headers, sizeof(headers), "Range: bytes=%lld-%lld\r\n", (long long)s->sink.offset, (long long)s->end);
+
+    Response    r;
+    Connection *c = request_open(s->pool, s->url, "GET", headers, &r);
+    if (c == NULL) return false;
+
+    // Server must answer with exactly the range requested
+    int64_t size = s->end - s->sink.offset + 1;
+    if (r.status != 206 || r.offset != s->sink.offset || (r.length >= 0 && r.length != size)) {
+        pool_release(s->pool, c, false);
+        s->refused = true;
+        return false;
+    }
+    return request_body(s->pool, c, &r, &s->sink, &s->stats) && s->sink.offset == s->end + 1;
+}
+
+/**
+ * Thread entry point for downloading segment.
+ * @param   arg         Pointer to segment
+ * @return  NULL
+ **/
+static void *segment_thread(void *arg) {
+    Segment *s = arg;
+    s->success = segment_fetch(s);
+    return NULL;
+}
+
+/**
+ * Size file to length, reserving its blocks up front when the file system
+ * supports it so parallel writes do not fragment it.
+ * @param   fd          File descriptor of output file
+ * @param   length      Final length of file
+ * @return  true on success, otherwise false
+ **/
+static bool preallocate(int fd, int64_t length) {
+    if (fallocate(fd, 0, 0, length) == 0) return true;
+    if (errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL) {
+        fprintf(stderr, "Unable to fallocate: %s\n", strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, length) < 0) {
+        fprintf(stderr, "Unable to ftruncate: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Download URL to file over parallel connections.
+ *
+ * A HEAD request learns the length of the body and whether the server accepts
+ * ranges.  The body is then split into byte ranges fetched concurrently, each
+ * written in place with pwrite.  Servers without range support, bodies of
+ * unknown length, and downloads whose ranges cannot be completed fall back to
+ * a single ordinary GET.
+ * @param   pool        Connection pool (used for the probe and first segment)
+ * @param   url         URL to download
+ * @param   fd          File descriptor of output file (opened for writing)
+ * @param   nsegments   Maximum number of parallel connections
+ * @param   stats       Transfer statistics to update
+ * @return  true if the whole body was written to the file, otherwise false
+ **/
+bool fetch_segments(Pool *pool, URL *url, int fd, int nsegments, Stats *stats) {
+    Sink sink = {fd, 0};
+
+    // Probe length and range support
+    Response    r;
+    Connection *c = request_open(pool, url, "HEAD", "", &r);
+    if (c == NULL) return false;
+    request_body(pool, c, &r, NULL, stats);
+
+    int64_t length = r.length;
+    if (r.status != 200 || !r.ranges || length <= 0) {
+        return fetch_url(pool, url, &sink, stats);
+    }
+
+    // Split body into ranges no smaller than SEGMENT_MINIMUM
+    if (nsegments > (length + SEGMENT_MINIMUM - 1) / SEGMENT_MINIMUM) {
+        nsegments = (length + SEGMENT_MINIMUM - 1) / SEGMENT_MINIMUM;
+    }
+    if (nsegments <= 1 || !preallocate(fd, length)) {
+        return fetch_url(pool, url, &sink, stats);
+    }
+
+    Segment *segments = calloc(nsegments, sizeof(Segment));
+    Pool    *pools    = calloc(nsegments, sizeof(Pool));
+    if (segments == NULL || pools == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        free(segments);
+        free(pools);
+        return false;
+    }
+
+    for (int i = 0; i < nsegments; i++) {
+        Segment *s = &segments[i];
+        pool_init(&pools[i]);
+        s->url         = url;
+        s->pool        = i == 0 ? pool : &pools[i];     // Reuse probe connection
+        s->sink.fd     = fd;
+        s->sink.offset = length * i / nsegments;
+        s->end         = length * (i + 1) / nsegments - 1;
+
+        if ((errno = pthread_create(&s->thread, NULL, segment_thread, s)) != 0) {
+            fprintf(stderr, "Unable to pthread_create: %s\n", strerror(errno));
+            s->thread = 0;
+        }
+    }
+
+    // Collect segments and retry any that stopped short once
+    bool success = true;
+    for (int i = 0; i < nsegments; i++) {
+        Segment *s = &segments[i];
+        if (s->thread) pthread_join(s->thread, NULL);
+        if (!s->success && !s->refused) {
+            s->pool    = pool;
+            s->success = segment_fetch(s);
+        }
+        success &= s->success;
+
+        stats->requests += s->stats.requests;
+        stats->bytes    += s->stats.bytes;
+        if (i > 0) {
+            pool->opened += pools[i].opened;
+            pool_delete(&pools[i]);
+        }
+    }
+
+    free(segments);
+    free(pools);
+
+    // Ranges were refused midway: start over with a single request
+    if (!success) {
+        fprintf(stderr, "Unable to fetch ranges of %s:%s/%s, fetching whole body\n", url->host, url->port, url->path);
+        if (ftruncate(fd, 0) < 0) return false;
+        return fetch_url(pool, url, &sink, stats);
+    }
+    return true;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,123 @@
+/* service.c: Service fingerprinting */
+
+#include "nmapit.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <regex.h>
+
+/* Structures */
+
+typedef struct {
+    const char *name;       // Service name
+    const char *pattern;    // Extended regular expression matched against banner
+    regex_t     regex;      // Compiled pattern
+    bool        compiled;   // Whether pattern compiled successfully
+} Signature;
+
+/* Signature Table (first match wins) */
+
+static Signature Signatures[] = {
+    {"ssh",     "^SSH-[0-9.]+-"},
+    {"http",    "^HTTP/[0-9.]+ [0-9]{3}"},
+    {"rtsp",    "^RTSP/[0-9.]+ [0-9]{3}"},
+    {"ftp",     "^220[ -].*FTP"},
+    {"smtp",    "^220[ -].*(SMTP|Postfix|Exim|Sendmail|Mail)"},
+    {"ftp",     "^220[ -]"},
+    {"pop3",    "^\\+OK"},
+    {"imap",    "^\\* (OK|PREAUTH)"},
+    {"vnc",     "^RFB [0-9]{3}\\.[0-9]{3}"},
+    {"redis",   "^-(ERR|NOAUTH|DENIED)"},
+    {"irc",     "^:[^ ]+ (NOTICE|[0-9]{3}) "},
+    {"xmpp",    "^<\\?xml|<stream:"},
+};
+
+#define NSIGNATURES (sizeof(Signatures) / sizeof(Signatures[0]))
+
+/* Ports where servers wait for the client to speak HTTP first */
+
+static const int HTTPPorts[] = {80, 591, 3000, 5000, 8000, 8008, 8080, 8081, 8888, 9000};
+
+#define NHTTPPORTS  (sizeof(HTTPPorts) / sizeof(HTTPPorts[0]))
+
+/* Functions */
+
+/**
+ * Compile signature table.
+ * @return  true if every signature compiled, otherwise false
+ **/
+bool service_init() {
+    bool success = true;
+    for (size_t i = 0; i < NSIGNATURES; i++) {
+        Signature *s = &Signatures[i];
+        if (s->compiled) continue;
+
+        int status = regcomp(&s->regex, s->pattern, REG_EXTENDED | REG_NEWLINE | REG_NOSUB);
+        if (status != 0) {
+            char error[BUFSIZ];
+            regerror(status, &s->regex, error, sizeof(error));
+            fprintf(stderr, "Unable to regcomp %s: %s\n", s->pattern, error);
+            success = false;
+            continue;
+        }
+        s->compiled = true;
+    }
+    return success;
+}
+
+/**
+ * Release compiled signature table.
+ **/
+void service_free() {
+    for (size_t i = 0; i < NSIGNATURES; i++) {
+        if (Signatures[i].compiled) regfree(&Signatures[i].regex);
+        Signatures[i].compiled = false;
+    }
+}
+
+/**
+ * Match banner against signature table.
+ * @param   banner      NUL-terminated banner
+ * @return  Service name, or NULL if no signature matches
+ **/
+const char *service_match(const char *banner) {
+    for (size_t i = 0; i < NSIGNATURES; i++) {
+        Signature *s = &Signatures[i];
+        if (s->compiled && regexec(&s->regex, banner, 0, NULL, 0) == 0) return s->name;
+    }
+    return NULL;
+}
+
+/**
+ * Determine whether port should be probed with HTTP immediately instead of
+ * first waiting for the server to send a banner.
+ * @param   port        Port number
+ * @return  true if port is commonly HTTP
+ **/
+bool service_probe_first(int port) {
+    for (size_t i = 0; i < NHTTPPORTS; i++) {
+        if (HTTPPorts[i] == port) return true;
+    }
+    return false;
+}
+
+/**
+ * Reduce banner in place to its first line with non-printable characters
+ * replaced.
+ * @param   banner      NUL-terminated banner
+ * @return  Pointer to banner
+ **/
+char *service_first_line(char *banner) {
+    for (char *c = banner; *c; c++) {
+        if (*c == '\r' || *c == '\n') {
+            *c = 0;
+            break;
+        }
+        if (!isprint((unsigned char)*c)) *c = '.';
+    }
+    return banner;
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
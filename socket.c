@@ -3,22 +3,136 @@
 #include "socket.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+/* Resolution Cache */
+
+typedef struct {
+    char        *host;      // Host string (NULL if entry is unused)
+    char        *port;      // Port string (may be NULL)
+    AddressSet  *set;       // Resolved addresses
+    time_t       expires;   // Time after which entry is stale
+} CacheEntry;
+
+static CacheEntry       Cache[SOCKET_CACHE_SIZE];
+static int              CacheTTL  = SOCKET_CACHE_TTL;
+static pthread_mutex_t  CacheLock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
- * Create socket connection to specified host and port.
- * @param   host        Host string to connect to.
- * @param   port        Port string to connect to.
- * @return  Socket file stream of connection if successful, otherwise NULL.
+ * Compare two possibly NULL strings for equality.
  **/
-FILE *socket_dial(const char *host, const char *port) {
+static int optional_streq(const char *a, const char *b) {
+    if (a == NULL || b == NULL) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+/**
+ * Allocate copy of address set.
+ * @param   set         Address set to copy
+ * @return  Newly allocated address set (must be deleted), or NULL on failure.
+ **/
+static AddressSet *address_set_copy(const AddressSet *set) {
+    AddressSet *copy = calloc(1, sizeof(AddressSet));
+    if (copy == NULL) return NULL;
+
+    copy->data = calloc(set->size, sizeof(Address));
+    if (copy->data == NULL) {
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy->data, set->data, set->size * sizeof(Address));
+    copy->size = set->size;
+    return copy;
+}
+
+/**
+ * Release cache entry.
+ * @param   e           Cache entry to clear
+ **/
+static void cache_clear(CacheEntry *e) {
+    free(e->host);
+    free(e->port);
+    address_set_delete(e->set);
+    memset(e, 0, sizeof(CacheEntry));
+}
+
+/**
+ * Look up fresh copy of cached resolution.
+ * @param   host        Host string
+ * @param   port        Port string
+ * @return  Copy of cached address set, or NULL if not cached or stale.
+ **/
+static AddressSet *cache_lookup(const char *host, const char *port) {
+    AddressSet *set = NULL;
+    time_t      now = time(NULL);
+
+    pthread_mutex_lock(&CacheLock);
+    for (size_t i = 0; i < SOCKET_CACHE_SIZE; i++) {
+        CacheEntry *e = &Cache[i];
+        if (e->host == NULL || !optional_streq(e->host, host) || !optional_streq(e->port, port))
+            continue;
+        if (e->expires <= now) cache_clear(e);
+        else set = address_set_copy(e->set);
+        break;
+    }
+    pthread_mutex_unlock(&CacheLock);
+    return set;
+}
+
+/**
+ * Store resolution in cache, replacing an unused or the oldest entry.
+ * @param   host        Host string
+ * @param   port        Port string
+ * @param   set         Address set to store (copied)
+ **/
+static void cache_store(const char *host, const char *port, const AddressSet *set) {
+    if (CacheTTL <= 0) return;
+
+    pthread_mutex_lock(&CacheLock);
+    CacheEntry *victim = &Cache[0];
+    for (size_t i = 0; i < SOCKET_CACHE_SIZE; i++) {
+        if (Cache[i].host == NULL) {
+            victim = &Cache[i];
+            break;
+        }
+        if (Cache[i].expires < victim->expires) victim = &Cache[i];
+    }
+    cache_clear(victim);
+
+    victim->host    = strdup(host);
+    victim->port    = port ? strdup(port) : NULL;
+    victim->set     = address_set_copy(set);
+    victim->expires = time(NULL) + CacheTTL;
+    if (victim->host == NULL || victim->set == NULL || (port && victim->port == NULL))
+        cache_clear(victim);
+    pthread_mutex_unlock(&CacheLock);
+}
+
+/* Address Functions */
+
+/**
+ * Resolve host and port into reusable set of addresses.
+ *
+ * Results are kept in an in-process cache for SOCKET_CACHE_TTL seconds, so
+ * repeated resolutions of the same host and port avoid the resolver.
+ * @param   host        Host string to resolve.
+ * @param   port        Port string to resolve (NULL leaves port unset).
+ * @return  Newly allocated address set (must be deleted), or NULL on failure.
+ **/
+AddressSet *socket_resolve(const char *host, const char *port) {
+    AddressSet *set = cache_lookup(host, port);
+    if (set) return set;
+
     /* Lookup server address information */
     struct addrinfo *results;
     struct addrinfo  hints = {
@@ -28,44 +142,240 @@ FILE *socket_dial(const char *host, const char *port) {
 
     int status;
     if ((status = getaddrinfo(host, port, &hints, &results)) != 0) {
-    	fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(status));
-	    return NULL;
+        fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(status));
+        return NULL;
     }
 
-    /* For each server entry, allocate socket and try to connect */
-    int client_fd = -1;
-    for (struct addrinfo *p = results; p != NULL && client_fd < 0; p = p->ai_next) {
-	    /* Allocate socket */
-	    if ((client_fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) {
-	        fprintf(stderr, "Unable to make socket: %s\n", strerror(errno));
-	        continue;
-	    }
-
-	    /* Connect to host */
-	    if (connect(client_fd, p->ai_addr, p->ai_addrlen) < 0) {
-	        close(client_fd);
-	        client_fd = -1;
-	        continue;
-	    }
+    /* Copy addresses into set */
+    size_t n = 0;
+    for (struct addrinfo *p = results; p != NULL; p = p->ai_next) n++;
+
+    set = calloc(1, sizeof(AddressSet));
+    if (set == NULL || (set->data = calloc(n, sizeof(Address))) == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
+        free(set);
+        freeaddrinfo(results);
+        return NULL;
+    }
+
+    for (struct addrinfo *p = results; p != NULL; p = p->ai_next) {
+        Address *a = &set->data[set->size++];
+        memcpy(&a->addr, p->ai_addr, p->ai_addrlen);
+        a->addrlen = p->ai_addrlen;
+        a->family  = p->ai_family;
     }
 
-    /* Release allocate address information */
     freeaddrinfo(results);
+    cache_store(host, port, set);
+    return set;
+}
+
+/**
+ * Deallocate address set.
+ * @param   set         Address set to delete.
+ **/
+void address_set_delete(AddressSet *set) {
+    if (set == NULL) return;
+    free(set->data);
+    free(set);
+}
+
+/**
+ * Set port number of address.
+ * @param   address     Address to modify.
+ * @param   port        Port number (host byte order).
+ **/
+void address_set_port(Address *address, int port) {
+    if (address->family == AF_INET6) ((struct sockaddr_in6 *)&address->addr)->sin6_port = htons(port);
+    else                             ((struct sockaddr_in *)&address->addr)->sin_port   = htons(port);
+}
+
+/**
+ * Set lifetime of cached resolutions (0 disables caching).
+ * @param   seconds     Time to live in seconds.
+ **/
+void socket_cache_ttl(int seconds) {
+    pthread_mutex_lock(&CacheLock);
+    CacheTTL = seconds;
+    pthread_mutex_unlock(&CacheLock);
+}
+
+/**
+ * Discard all cached resolutions.
+ **/
+void socket_cache_flush() {
+    pthread_mutex_lock(&CacheLock);
+    for (size_t i = 0; i < SOCKET_CACHE_SIZE; i++) cache_clear(&Cache[i]);
+    pthread_mutex_unlock(&CacheLock);
+}
+
+/* File Descriptor Functions */
+
+/**
+ * Create unconnected TCP socket.
+ * @param   family      Address family (AF_INET or AF_INET6).
+ * @param   flags       Bitmask of SOCKET_* dial flags.
+ * @return  Socket file descriptor (must be closed), otherwise -1.
+ **/
+int socket_open(int family, int flags) {
+    /* Allocate socket */
+    int type = SOCK_STREAM;
+    if (flags & SOCKET_NONBLOCK) type |= SOCK_NONBLOCK;
+    if (flags & SOCKET_CLOEXEC)  type |= SOCK_CLOEXEC;
+
+    int client_fd;
+    if ((client_fd = socket(family, type, 0)) < 0) {
+        fprintf(stderr, "Unable to make socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Apply socket options */
+    if (flags & SOCKET_NODELAY) {
+        int one = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (flags & SOCKET_LINGER0) {
+        struct linger linger = {.l_onoff = 1, .l_linger = 0};
+        setsockopt(client_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+
+    return client_fd;
+}
+
+/**
+ * Create socket connected (or connecting) to address.
+ *
+ * With SOCKET_NONBLOCK the connect may still be in progress when this
+ * returns; wait for writability and check socket_error() for the result.
+ * @param   address     Address to connect to.
+ * @param   flags       Bitmask of SOCKET_* dial flags.
+ * @return  Socket file descriptor (must be closed), otherwise -1.
+ **/
+int socket_connect(const Address *address, int flags) {
+    int client_fd = socket_open(address->family, flags);
+    if (client_fd < 0) return -1;
+
+    /* Connect to host */
+    if (connect(client_fd, (struct sockaddr *)&address->addr, address->addrlen) < 0) {
+        if ((flags & SOCKET_NONBLOCK) && errno == EINPROGRESS) return client_fd;
+
+        int saved = errno;
+        close(client_fd);
+        errno = saved;
+        return -1;
+    }
+
+    return client_fd;
+}
+
+/**
+ * Create socket connection to specified host and port.
+ * @param   host        Host string to connect to.
+ * @param   port        Port string to connect to.
+ * @param   flags       Bitmask of SOCKET_* dial flags.
+ * @return  Socket file descriptor (must be closed), otherwise -1.
+ **/
+int socket_dial_fd(const char *host, const char *port, int flags) {
+    AddressSet *set = socket_resolve(host, port);
+    if (set == NULL) return -1;
+
+    /* For each server entry, allocate socket and try to connect */
+    int client_fd = -1;
+    for (size_t i = 0; i < set->size && client_fd < 0; i++) {
+        client_fd = socket_connect(&set->data[i], flags);
+    }
 
     if (client_fd < 0) {
-	fprintf(stderr, "Unable to connect to %s:%s: %s\n", host, port, strerror(errno));
-    	return NULL;
+        fprintf(stderr, "Unable to connect to %s:%s: %s\n", host, port, strerror(errno));
     }
 
+    address_set_delete(set);
+    return client_fd;
+}
+
+/**
+ * Retrieve pending error of socket (ie. result of non-blocking connect).
+ * @param   fd          Socket file descriptor.
+ * @return  0 if connected, otherwise error number.
+ **/
+int socket_error(int fd) {
+    int       error = 0;
+    socklen_t len   = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) return errno;
+    return error;
+}
+
+/**
+ * Close socket file descriptor.
+ *
+ * Sockets dialed with SOCKET_LINGER0 are reset rather than shutdown, so
+ * they do not linger in TIME_WAIT.
+ * @param   fd          Socket file descriptor.
+ * @return  0 if successful, otherwise -1.
+ **/
+int socket_close(int fd) {
+    if (fd < 0) return 0;
+    return close(fd);
+}
+
+/**
+ * Open file stream on socket file descriptor.
+ *
+ * The stream takes ownership of the file descriptor; close it with fclose.
+ * @param   fd          Connected socket file descriptor.
+ * @return  Socket file stream if successful, otherwise NULL.
+ **/
+FILE *socket_fdopen(int fd) {
     /* Open file stream from socket file descriptor */
-    FILE *client_file = fdopen(client_fd, "w+");
+    FILE *client_file = fdopen(fd, "w+");
     if (!client_file) {
         fprintf(stderr, "Unable to fdopen: %s\n", strerror(errno));
-        close(client_fd);
+        close(fd);
         return NULL;
     }
 
     return client_file;
 }
 
+/* Stream Functions */
+
+/**
+ * Create socket connection to specified address.
+ * @param   address     Address to connect to.
+ * @return  Socket file stream of connection if successful, otherwise NULL.
+ **/
+FILE *socket_dial_address(const Address *address) {
+    int client_fd = socket_connect(address, 0);
+    if (client_fd < 0) return NULL;
+    return socket_fdopen(client_fd);
+}
+
+/**
+ * Create socket connection to first reachable address in set.
+ * @param   set         Address set to try in order.
+ * @return  Socket file stream of connection if successful, otherwise NULL.
+ **/
+FILE *socket_dial_set(const AddressSet *set) {
+    /* For each server entry, allocate socket and try to connect */
+    int client_fd = -1;
+    for (size_t i = 0; i < set->size && client_fd < 0; i++) {
+        client_fd = socket_connect(&set->data[i], 0);
+    }
+
+    if (client_fd < 0) return NULL;
+    return socket_fdopen(client_fd);
+}
+
+/**
+ * Create socket connection to specified host and port.
+ * @param   host        Host string to connect to.
+ * @param   port        Port string to connect to.
+ * @return  Socket file stream of connection if successful, otherwise NULL.
+ **/
+FILE *socket_dial(const char *host, const char *port) {
+    int client_fd = socket_dial_fd(host, port, 0);
+    if (client_fd < 0) return NULL;
+    return socket_fdopen(client_fd);
+}
+
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
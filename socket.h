@@ -2,10 +2,83 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include <sys/socket.h>
+
+/* Constants */
+
+#define SOCKET_CACHE_TTL    60      /* Seconds a resolution stays cached */
+#define SOCKET_CACHE_SIZE   64      /* Number of cached resolutions */
+
+/* Dial Flags */
+
+enum {
+    SOCKET_NONBLOCK = 1<<0,         /* Return immediately while connect is pending */
+    SOCKET_CLOEXEC  = 1<<1,         /* Close socket on exec */
+    SOCKET_NODELAY  = 1<<2,         /* Disable Nagle's algorithm (TCP_NODELAY) */
+    SOCKET_LINGER0  = 1<<3,         /* Reset connection on close (SO_LINGER zero) */
+};
+
+/* Address Structures */
+
+typedef struct {
+    struct sockaddr_storage addr;   // Socket address (including port)
+    socklen_t               addrlen;// Length of socket address
+    int                     family; // Address family (AF_INET or AF_INET6)
+} Address;
+
+typedef struct {
+    Address    *data;               // Array of resolved addresses
+    size_t      size;               // Number of resolved addresses
+} AddressSet;
+
+/* Address Functions */
+
+AddressSet *    socket_resolve(const char *host, const char *port);
+void            address_set_delete(AddressSet *set);
+void            address_set_port(Address *address, int port);
+void            socket_cache_ttl(int seconds);
+void            socket_cache_flush();
+
+/* File Descriptor Functions */
+
+int     socket_open(int family, int flags);
+int     socket_connect(const Address *address, int flags);
+int     socket_dial_fd(const char *host, const char *port, int flags);
+int     socket_error(int fd);
+int     socket_close(int fd);
+FILE *  socket_fdopen(int fd);
+
+/* Asynchronous I/O Ring */
+
+enum {
+    RING_EPOLL,                     /* Readiness-based fallback (epoll) */
+    RING_URING,                     /* Completion-based (io_uring) */
+};
+
+typedef struct {
+    void   *data;                   // Data pointer the operation was queued with
+    int     result;                 // Bytes transferred (or 0), otherwise -errno
+} Completion;
+
+typedef struct Ring Ring;
+
+Ring *  ring_create(unsigned entries, int backend);
+void    ring_delete(Ring *ring);
+int     ring_backend(Ring *ring);
+bool    ring_connect(Ring *ring, int fd, const Address *address, void *data);
+bool    ring_send(Ring *ring, int fd, const void *buffer, size_t size, void *data);
+bool    ring_recv(Ring *ring, int fd, void *buffer, size_t size, void *data);
+bool    ring_cancel(Ring *ring, void *data);
+int     ring_wait(Ring *ring, Completion *completions, int max, int64_t timeout);
+
 /* Functions */
 
 FILE *	socket_dial(const char *host, const char *port);
+FILE *	socket_dial_address(const Address *address);
+FILE *	socket_dial_set(const AddressSet *set);
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
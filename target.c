@@ -0,0 +1,177 @@
+/* target.c: Target specification expansion */
+
+#include "nmapit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/* Constants */
+
+#define WHITESPACE  " \t\r\n"
+
+/* Functions */
+
+/**
+ * Parse IPv4 address string.
+ * @param   s           Address string (ie. 10.0.0.1)
+ * @param   ip          Pointer to address in host byte order
+ * @return  true if string is an IPv4 address, otherwise false
+ **/
+static bool parse_ipv4(const char *s, uint32_t *ip) {
+    struct in_addr in;
+    if (inet_pton(AF_INET, s, &in) != 1) return false;
+    *ip = ntohl(in.s_addr);
+    return true;
+}
+
+/**
+ * Parse CIDR block or address range into first and last addresses.
+ *
+ * Accepted forms are A.B.C.D/N, A.B.C.D-E and A.B.C.D-W.X.Y.Z.
+ * @param   spec        Target specification
+ * @param   first       Pointer to first address in host byte order
+ * @param   last        Pointer to last address in host byte order
+ * @return  true if specification is a block or range, otherwise false
+ **/
+static bool parse_range(const char *spec, uint32_t *first, uint32_t *last) {
+    char buffer[NI_MAXHOST];
+    strncpy(buffer, spec, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = 0;
+
+    // CIDR block
+    char *slash = strchr(buffer, '/');
+    if (slash) {
+        *slash = 0;
+        char *end;
+        long  prefix = strtol(slash + 1, &end, 10);
+        if (*end || prefix < 0 || prefix > 32 || !parse_ipv4(buffer, first)) return false;
+
+        uint32_t mask = prefix == 0 ? 0 : UINT32_MAX << (32 - prefix);
+        *first &= mask;
+        *last   = *first | ~mask;
+        return true;
+    }
+
+    // Address range (host names may also contain dashes)
+    char *dash = strchr(buffer, '-');
+    if (dash) {
+        *dash = 0;
+        if (!parse_ipv4(buffer, first)) return false;
+
+        char *end;
+        long  octet = strtol(dash + 1, &end, 10);
+        if (*end == 0 && end != dash + 1 && octet >= 0 && octet <= 255) {
+            *last = (*first & 0xFFFFFF00) | octet;
+        } else if (!parse_ipv4(dash + 1, last)) {
+            return false;
+        }
+        return *first <= *last;
+    }
+
+    return false;
+}
+
+/**
+ * Determine whether specification names exactly one host.
+ * @param   spec        Target specification
+ * @return  true if specification is a single host name or address
+ **/
+bool target_is_single(const char *spec) {
+    uint32_t first, last;
+    return !parse_range(spec, &first, &last) || first == last;
+}
+
+/**
+ * Initialize target stream.
+ * @param   ts          Pointer to target stream
+ * @param   specs       Array of target specification strings
+ * @param   nspecs      Number of target specification strings
+ * @param   file        Stream with one specification per line (may be NULL)
+ **/
+void target_stream_init(TargetStream *ts, char **specs, size_t nspecs, FILE *file) {
+    memset(ts, 0, sizeof(TargetStream));
+    ts->specs  = specs;
+    ts->nspecs = nspecs;
+    ts->file   = file;
+}
+
+/**
+ * Retrieve next target specification from arguments or file.
+ * @param   ts          Pointer to target stream
+ * @param   buffer      Buffer to store specification
+ * @param   size        Size of buffer
+ * @return  true if a specification was retrieved, otherwise false
+ **/
+static bool target_stream_spec(TargetStream *ts, char *buffer, size_t size) {
+    if (ts->index < ts->nspecs) {
+        strncpy(buffer, ts->specs[ts->index++], size - 1);
+        buffer[size - 1] = 0;
+        return true;
+    }
+
+    // Read non-empty, non-comment lines from file
+    while (ts->file && fgets(buffer, size, ts->file)) {
+        char *hash = strchr(buffer, '#');
+        if (hash) *hash = 0;
+
+        char *token = strtok(buffer, WHITESPACE);
+        if (token == NULL) continue;
+        memmove(buffer, token, strlen(token) + 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Produce next target, lazily expanding blocks and ranges.
+ *
+ * Not thread-safe; callers sharing a stream must serialize access.
+ * @param   ts          Pointer to target stream
+ * @param   target      Pointer to target to fill in
+ * @return  true if a target was produced, false when stream is exhausted
+ **/
+bool target_stream_next(TargetStream *ts, Target *target) {
+    for (;;) {
+        // Continue expanding current range
+        if (ts->ranging) {
+            struct sockaddr_in *sin = (struct sockaddr_in *)&target->address.addr;
+            memset(&target->address, 0, sizeof(Address));
+            sin->sin_family           = AF_INET;
+            sin->sin_addr.s_addr      = htonl(ts->next);
+            target->address.addrlen   = sizeof(struct sockaddr_in);
+            target->address.family    = AF_INET;
+            inet_ntop(AF_INET, &sin->sin_addr, target->name, sizeof(target->name));
+
+            if (ts->next == ts->last) ts->ranging = false;
+            else ts->next++;
+            return true;
+        }
+
+        char spec[NI_MAXHOST];
+        if (!target_stream_spec(ts, spec, sizeof(spec))) return false;
+
+        // Begin expanding block or range
+        if (parse_range(spec, &ts->next, &ts->last)) {
+            ts->ranging = true;
+            continue;
+        }
+
+        // Resolve single host (skip on failure)
+        AddressSet *set = socket_resolve(spec, NULL);
+        if (set == NULL) continue;
+        if (set->size == 0) {
+            address_set_delete(set);
+            continue;
+        }
+
+        strcpy(target->name, spec);
+        target->address = set->data[0];
+        address_set_delete(set);
+        return true;
+    }
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -1,33 +1,34 @@
 /* timeit.c: Run command with a time limit */
 
+#define _GNU_SOURCE
+
+#include "timeit.h"
+
 #include <errno.h>
-#include <stdbool.h>
-#include <stdio.h>
+#include <limits.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
-#include <fcntl.h>
-#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-/* Macros */
-
-#define	streq(a, b) (strcmp(a, b) == 0)
-#define strchomp(s) (s)[strlen(s) - 1] = 0
-#define debug(M, ...) \
-    if (Verbose) { \
-        fprintf(stderr, "%s:%d:%s: " M, __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
-    }
-
-#define BILLION 1000000000.0
-
 /* Globals */
 
-int  Timeout  = 10;
-bool Verbose  = false;
-int  ChildPid = 0;
+double  Timeout    = 10;
+double  Grace      = 1;
+double  Interval   = 0;
+char   *Series     = NULL;
+bool    Verbose    = false;
+bool    Counting   = false;
+int     Runs       = 1;
+int     Warmups    = 0;
+char   *Prepare    = NULL;
+bool    DropCaches = false;
+char   *Output     = NULL;
+char   *Format     = "csv";
+int     Parallel   = 0;
+char   *Input      = NULL;
 
 /* Functions */
 
@@ -37,17 +38,58 @@ int  ChildPid = 0;
  **/
 void	usage(int status) {
     fprintf(stderr, "Usage: timeit [options] command...\n");
+    fprintf(stderr, "       timeit [-t SECONDS] [-k SECONDS] [-c] [-v] -j N [-i FILE]\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "    -t SECONDS  Timeout duration before killing command (default is %d)\n", Timeout);
+    fprintf(stderr, "    -t SECONDS  Timeout duration before killing command (default is %g)\n", Timeout);
+    fprintf(stderr, "    -k SECONDS  Grace period between SIGTERM and SIGKILL (default is %g)\n", Grace);
+    fprintf(stderr, "    -c          Count task clock, cycles, instructions, and cache misses\n");
+    fprintf(stderr, "    -r N        Measure N runs and summarize them (default is %d)\n", Runs);
+    fprintf(stderr, "    -w N        Run command N times before measuring (default is %d)\n", Warmups);
+    fprintf(stderr, "    -p COMMAND  Run shell COMMAND before every run\n");
+    fprintf(stderr, "    -C          Drop page, dentry, and inode caches before every run\n");
+    fprintf(stderr, "    -o FILE     Export every measured run to FILE\n");
+    fprintf(stderr, "    -f FORMAT   Write runs and samples as csv or json (default is %s)\n", Format);
+    fprintf(stderr, "    -s SECONDS  Sample CPU, RSS, and I/O of command every SECONDS\n");
+    fprintf(stderr, "    -S FILE     Write samples to FILE instead of after the summary\n");
+    fprintf(stderr, "    -j N        Run shell commands read one per line, N at a time\n");
+    fprintf(stderr, "    -i FILE     Read commands from FILE instead of standard input\n");
     fprintf(stderr, "    -v          Display verbose debugging output\n");
     exit(status);
 }
 
+/**
+ * Parse number of seconds, exiting with usage message unless the whole
+ * argument is a finite, non-negative number.
+ * @param   arg         Command line argument.
+ * @return  Number of seconds.
+ **/
+double  parse_seconds(const char *arg) {
+    char  *end;
+    double value = strtod(arg, &end);
+    if (end == arg || *end || !isfinite(value) || value < 0) usage(1);
+    return value;
+}
+
+/**
+ * Parse count, exiting with usage message unless the whole argument is a
+ * non-negative integer.
+ * @param   arg         Command line argument.
+ * @return  Count.
+ **/
+int     parse_count(const char *arg) {
+    char *end;
+    errno = 0;
+    long  value = strtol(arg, &end, 10);
+    if (end == arg || *end || errno || value < 0 || value > INT_MAX) usage(1);
+    return value;
+}
+
 /**
  * Parse command line options.
  * @param   argc        Number of command line arguments.
  * @param   argv        Array of command line argument strings.
- * @return  Array of strings representing command to execute (must be freed).
+ * @return  Array of strings representing command to execute (must be freed),
+ *          or NULL when running a batch of commands.
  **/
 char ** parse_options(int argc, char **argv) {
     // Iterate through command line arguments to determine Timeout and
@@ -59,15 +101,60 @@ char ** parse_options(int argc, char **argv) {
         if (streq(argv[i],"-t")) {
             if (argc > i+1) {
                 i++;
-                Timeout = atoi(argv[i]);
+                Timeout = parse_seconds(argv[i]);
             } else usage(1);
+        } else if (streq(argv[i], "-k")) {
+            if (argc <= i+1) usage(1);
+            Grace = parse_seconds(argv[++i]);
+        } else if (streq(argv[i], "-c")) {
+            Counting = true;
+        } else if (streq(argv[i], "-r")) {
+            if (argc <= i+1) usage(1);
+            Runs = parse_count(argv[++i]);
+        } else if (streq(argv[i], "-w")) {
+            if (argc <= i+1) usage(1);
+            Warmups = parse_count(argv[++i]);
+        } else if (streq(argv[i], "-p")) {
+            if (argc <= i+1) usage(1);
+            Prepare = argv[++i];
+        } else if (streq(argv[i], "-C")) {
+            DropCaches = true;
+        } else if (streq(argv[i], "-o")) {
+            if (argc <= i+1) usage(1);
+            Output = argv[++i];
+        } else if (streq(argv[i], "-f")) {
+            if (argc <= i+1) usage(1);
+            Format = argv[++i];
+        } else if (streq(argv[i], "-s")) {
+            if (argc <= i+1) usage(1);
+            Interval = parse_seconds(argv[++i]);
+        } else if (streq(argv[i], "-S")) {
+            if (argc <= i+1) usage(1);
+            Series = argv[++i];
+        } else if (streq(argv[i], "-j")) {
+            if (argc <= i+1) usage(1);
+            Parallel = parse_count(argv[++i]);
+        } else if (streq(argv[i], "-i")) {
+            if (argc <= i+1) usage(1);
+            Input = argv[++i];
         } else if (streq(argv[i], "-v")) {
             Verbose = true;
         } else break;
     }
 
-    debug("Timeout = %d\n", Timeout);
+    if (Timeout < 0 || Grace < 0 || Interval < 0 || (Series && Interval == 0) || Runs < 1 || Warmups < 0 || !(streq(Format, "csv") || streq(Format, "json"))) usage(1);
+
+    debug("Timeout = %g, Grace = %g\n", Timeout, Grace);
     debug("Verbose = %d\n", Verbose);
+    debug("Counting = %d\n", Counting);
+    debug("Runs = %d, Warmups = %d\n", Runs, Warmups);
+    debug("Parallel = %d\n", Parallel);
+
+    // Batch mode reads commands instead of taking one from arguments
+    if (Parallel || Input) {
+        if (Parallel < 1 || i < argc || Runs != 1 || Warmups || Prepare || DropCaches || Output || Interval) usage(1);
+        return NULL;
+    }
 
     // Copy remaining arguments into new array of strings
     char **command = calloc(argc-i+1, sizeof(char*));
@@ -91,13 +178,33 @@ char ** parse_options(int argc, char **argv) {
 }
 
 /**
- * Handle signal.
- * @param   signum      Signal number.
+ * Bring system to the same state before every run by dropping caches and
+ * running the prepare command.
+ * @return  Whether or not the system was prepared.
  **/
-void    handle_signal(int signum) {
-    // Kill child process
-    debug("Killing child %d...\n", ChildPid);
-    kill(ChildPid, SIGKILL);
+bool    prepare_run() {
+    if (DropCaches) {
+        debug("Dropping caches...\n");
+        sync();
+
+        FILE *fp = fopen("/proc/sys/vm/drop_caches", "w");
+        if (fp == NULL || fputs("3\n", fp) == EOF || fclose(fp) == EOF) {
+            fprintf(stderr, "Unable to drop caches: %s\n", strerror(errno));
+            return false;
+        }
+    }
+
+    if (Prepare) {
+        debug("Preparing with %s...\n", Prepare);
+        fflush(stdout);
+
+        int status = system(Prepare);
+        if (status < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "Unable to prepare: %s failed\n", Prepare);
+            return false;
+        }
+    }
+    return true;
 }
 
 /* Main Execution */
@@ -110,62 +217,79 @@ int	main(int argc, char *argv[]) {
 
     char **command = parse_options(argc, argv);
 
-    // Register alarm handler and save start time
-    debug("Registering handlers...\n");
-    signal(SIGALRM, handle_signal);
+    if (command == NULL) {
+        FILE *input = Input ? fopen(Input, "r") : stdin;
+        if (input == NULL) {
+            fprintf(stderr, "Unable to open %s: %s\n", Input, strerror(errno));
+            return EXIT_FAILURE;
+        }
 
-    debug("Grabbing start time...\n");
-    struct timespec start_time;
-    clock_gettime(CLOCK_MONOTONIC, &start_time);
+        bool success = jobs_run(input, Parallel);
+        if (Input) fclose(input);
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    // Fork child process:
-    pid_t pid = fork();
+    // Warm up, then measure every run
+    Measurement *measurements = calloc(Runs, sizeof(Measurement));
+    Measurement  warmup;
+    SampleList   samples = {NULL, 0, 0};
+    int          status = 0;
 
-    if (pid < 0) {
-        fprintf(stderr, "Unable to fork: %s\n", strerror(errno));
+    if (measurements == NULL) {
+        fprintf(stderr, "Unable to calloc: %s\n", strerror(errno));
         free(command);
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
     }
 
-    //  1. Child executes command parsed from command line
-    debug("Executing child...\n");
-    if (pid == 0) {
-        execvp(command[0], command);
-        fprintf(stderr, "Unable to execvp: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < Warmups + Runs; i++) {
+        Measurement *measurement = i < Warmups ? &warmup : &measurements[i - Warmups];
+
+        if (!prepare_run() || !job_run(command, measurement, i < Warmups ? NULL : &samples, i - Warmups + 1)) {
+            free(samples.data);
+            free(measurements);
+            free(command);
+            return EXIT_FAILURE;
+        }
+        debug("Run %d took %0.3lf seconds\n", i - Warmups, measurement->elapsed);
+
+        // Exit with status of first failed run
+        int code = WIFEXITED(measurement->status) ? WEXITSTATUS(measurement->status) : WTERMSIG(measurement->status);
+        if (i >= Warmups && status == 0) status = code;
+
+        // Stop at first interrupted run, summarizing those measured so far
+        if (measurement->interrupted) {
+            Runs = i < Warmups ? 0 : i - Warmups + 1;
+            if (status == 0) status = EXIT_FAILURE;
+            break;
+        }
     }
-    //  2. Parent sets alarm based on Timeout and waits for child
-    else { 
-        alarm(Timeout);
-        
-        ChildPid = pid;
-
-        int status;
-        wait(&status);
 
-        debug("Sleeping for %d seconds...\n", Timeout);
-        debug("Waiting for child %d...\n", ChildPid);
-
-        debug("Child exit status: %d\n", status);
-
-        debug("Grabbing end time...\n");
-        struct timespec end_time;
-        clock_gettime(CLOCK_MONOTONIC, &end_time);
-        
-        double elapsed_time = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / BILLION;
-
-        printf("Time Elapsed: %0.1lf\n", elapsed_time);
-
-        // Cleanup
-        free(command);
-
-        status = WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status);
+    if (Runs == 1) {
+        measurement_print(stdout, &measurements[0]);
+    } else if (Runs > 1) {
+        summary_print(stdout, measurements, Runs, Warmups);
+    }
 
-        return status;
+    if (Output && Runs && !report_export(Output, Format, command, measurements, Runs)) status = EXIT_FAILURE;
+
+    // Time series goes after the summary unless it has a file of its own
+    if (Interval > 0) {
+        FILE *stream = Series ? fopen(Series, "w") : stdout;
+        if (stream == NULL) {
+            fprintf(stderr, "Unable to open %s: %s\n", Series, strerror(errno));
+            status = EXIT_FAILURE;
+        } else {
+            samples_write(stream, Format, &samples);
+            if (Series) fclose(stream);
+        }
     }
 
+    // Cleanup
+    free(samples.data);
+    free(measurements);
     free(command);
 
+    return status;
 }
 
 /* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
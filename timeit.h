@@ -0,0 +1,115 @@
+/* timeit.h: Run command with a time limit */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Constants */
+
+#define BILLION     1000000000.0
+#define JOBS_EVENTS 64              /* Events handled per epoll_wait */
+
+/* Perf Counters */
+
+enum {
+    COUNTER_TASK_CLOCK,     // Nanoseconds spent on CPU
+    COUNTER_CYCLES,         // CPU cycles
+    COUNTER_INSTRUCTIONS,   // Instructions retired
+    COUNTER_CACHE_MISSES,   // Last level cache misses
+    NCOUNTERS,
+};
+
+/* Macros */
+
+#define	streq(a, b) (strcmp(a, b) == 0)
+#define strchomp(s) (s)[strlen(s) - 1] = 0
+#define debug(M, ...) \
+    if (Verbose) { \
+        fprintf(stderr, "%s:%d:%s: " M, __FILE__, __LINE__, __func__, ##__VA_ARGS__); \
+    }
+
+/* Structures */
+
+typedef struct {
+    int             fds[NCOUNTERS];     // Perf event descriptors (-1 if unavailable)
+    uint64_t        values[NCOUNTERS];  // Counts, scaled for multiplexing
+    bool            valid[NCOUNTERS];   // Whether each count was collected
+} Counters;
+
+typedef struct {
+    int             status;     // Wait status of command
+    double          elapsed;    // Wall clock seconds
+    struct rusage   usage;      // Resources used by command and its children
+    bool            expired;    // Whether command was signalled for passing its deadline
+    bool            interrupted;// Whether timeit was signalled while command ran
+    bool            counted;    // Whether any perf counter was attached
+    Counters        counters;   // Perf counters inherited by children
+} Measurement;
+
+typedef struct {
+    double          mean;       // Arithmetic mean
+    double          stddev;     // Sample standard deviation
+    double          median;     // Middle value
+    double          min;        // Smallest value
+    double          max;        // Largest value
+    double          lower;      // Lower outlier fence (first quartile - 1.5 IQR)
+    double          upper;      // Upper outlier fence (third quartile + 1.5 IQR)
+    size_t          outliers;   // Number of values outside fences
+} Summary;
+
+typedef struct {
+    int             run;        // Run sampled (1 for first measured run)
+    double          time;       // Seconds since command started
+    int             processes;  // Processes in command's process group
+    int             threads;    // Threads of those processes
+    double          cpu;        // CPU seconds used so far (including reaped children)
+    long            rss;        // Resident set size in KB
+    uint64_t        rchar;      // Bytes read through read-like system calls
+    uint64_t        wchar;      // Bytes written through write-like system calls
+    uint64_t        read_bytes; // Bytes fetched from storage
+    uint64_t        write_bytes;// Bytes sent to storage
+} Sample;
+
+typedef struct {
+    Sample         *data;       // Array of samples in time order
+    size_t          size;       // Number of samples
+    size_t          capacity;   // Capacity of array
+} SampleList;
+
+/* Globals */
+
+extern double Timeout;
+extern double Grace;
+extern double Interval;
+extern bool   Verbose;
+extern bool   Counting;
+
+/* Measure Functions */
+
+bool    counters_open(Counters *counters, pid_t pid);
+void    counters_collect(Counters *counters);
+void    measurement_print(FILE *stream, const Measurement *measurement);
+
+/* Report Functions */
+
+bool    summary_compute(const double *values, size_t n, Summary *summary);
+void    summary_print(FILE *stream, const Measurement *measurements, size_t n, int warmups);
+bool    report_export(const char *path, const char *format, char **command, const Measurement *measurements, size_t n);
+
+/* Job Functions */
+
+bool    job_run(char **argv, Measurement *measurement, SampleList *samples, int run);
+bool    jobs_run(FILE *input, int parallel);
+
+/* Sample Functions */
+
+bool    sample_group(pid_t pgid, Sample *sample);
+bool    samples_append(SampleList *list, const Sample *sample);
+void    samples_write(FILE *stream, const char *format, const SampleList *list);
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,78 @@
+/* timing.c: Per-phase request latency */
+
+#include "curlit.h"
+
+#include <time.h>
+
+/* Constants */
+
+static const char *PhaseNames[NPHASES] = {
+    [PHASE_RESOLVE]     = "dns",
+    [PHASE_CONNECT]     = "connect",
+    [PHASE_WRITE]       = "write",
+    [PHASE_FIRST_BYTE]  = "first_byte",
+    [PHASE_TRANSFER]    = "transfer",
+    [PHASE_TOTAL]       = "total",
+};
+
+/* Functions */
+
+/**
+ * Return monotonic time in microseconds.
+ **/
+uint64_t timing_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Record phase durations of completed request.
+ * @param   phases      Histograms indexed by phase
+ * @param   r           Response of completed request
+ **/
+void timing_record(Histogram *phases, const Response *r) {
+    for (int p = 0; p < NPHASES; p++) histogram_record(&phases[p], r->timing[p]);
+}
+
+/**
+ * Print phase latency summary.
+ *
+ * The text form is a table in milliseconds; the JSON form is a single object
+ * with durations in microseconds.
+ * @param   stream      Stream to print to
+ * @param   phases      Histograms indexed by phase
+ * @param   stats       Transfer statistics
+ * @param   elapsed     Wall-clock time of whole run (s)
+ * @param   json        Whether to print JSON instead of text
+ **/
+void timing_report(FILE *stream, const Histogram *phases, const Stats *stats, double elapsed, bool json) {
+    if (json) {
+        fprintf(stream, "{\"requests\": %zu, \"bytes\": %lu, \"elapsed\": %.6f, \"phases\": {", stats->requests, stats->bytes, elapsed);
+        for (int p = 0; p < NPHASES; p++) {
+            const Histogram *h = &phases[p];
+            fprintf(stream, "%s\"%s\": {\"min\": %lu, \"median\": %lu, \"p99\": %lu, \"max\": %lu, \"mean\": %.1f}",
+                p ? ", " : "", PhaseNames[p],
+                h->total ? h->min : 0,
+                histogram_percentile(h, 50),
+                histogram_percentile(h, 99),
+                h->max,
+                histogram_mean(h));
+        }
+        fprintf(stream, "}}\n");
+        return;
+    }
+
+    fprintf(stream, "%-12s %10s %10s %10s %10s %10s\n", "Phase (ms)", "min", "median", "p99", "max", "mean");
+    for (int p = 0; p < NPHASES; p++) {
+        const Histogram *h = &phases[p];
+        fprintf(stream, "%-12s %10.3f %10.3f %10.3f %10.3f %10.3f\n", PhaseNames[p],
+            (h->total ? h->min : 0) / 1000.0,
+            histogram_percentile(h, 50) / 1000.0,
+            histogram_percentile(h, 99) / 1000.0,
+            h->max / 1000.0,
+            histogram_mean(h) / 1000.0);
+    }
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */
@@ -0,0 +1,54 @@
+/* url.c: URL parsing */
+
+#include "curlit.h"
+
+#include <string.h>
+
+/* Functions */
+
+/**
+ * Parse URL string into URL structure.
+ * @param   s       URL string
+ * @param   url     Pointer to URL structure
+ **/
+void    parse_url(const char *s, URL *url) {
+    // Copy data to local buffer
+    char buffer[BUFSIZ];
+    strncpy(buffer, s, BUFSIZ - 1);
+    buffer[BUFSIZ - 1] = '\0';
+
+    // Skip scheme to host
+    char *scheme = strstr(buffer, HOST_DELIMITER);
+    if (scheme == NULL) {
+       scheme = buffer;
+    } else {
+        scheme += strlen(HOST_DELIMITER);
+    }
+
+    // Split host:port from path
+    char *urlpath;
+    urlpath = strchr(scheme, PATH_DELIMITER);
+
+    if (urlpath == NULL) urlpath = "";
+    else {
+        *urlpath = '\0';
+        urlpath++;
+    }
+
+    // Split host and port
+    char *urlport;
+    urlport = strchr(scheme, PORT_DELIMITER);
+
+    if (urlport == NULL) urlport = "80";
+    else {
+        *urlport = '\0';
+        urlport++;
+    }
+
+    // Copy components to URL
+    snprintf(url->host, sizeof(url->host), "%.*s", (int)sizeof(url->host) - 1, scheme);
+    snprintf(url->port, sizeof(url->port), "%.*s", (int)sizeof(url->port) - 1, urlport);
+    snprintf(url->path, sizeof(url->path), "%.*s", (int)sizeof(url->path) - 1, urlpath);
+}
+
+/* vim: set sts=4 sw=4 ts=8 expandtab ft=c: */